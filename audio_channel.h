@@ -2,6 +2,7 @@
 #define AUDIO_CHANNEL_H_INCLUDED
 
 #include <array>
+#include <cstddef>
 
 enum class AudioChannel
 {
@@ -14,4 +15,6 @@ enum class AudioChannel
 template <typename T>
 using array_AudioChannel = std::array<T, (std::size_t)AudioChannel::Last + 1>;
 
+constexpr std::size_t audioChannelCount = (std::size_t)AudioChannel::Last + 1;
+
 #endif // AUDIO_CHANNEL_H_INCLUDED
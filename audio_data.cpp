@@ -5,6 +5,10 @@
 #include <endian.h>
 #include <stdexcept>
 #include <cassert>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <new>
 
 using namespace std;
 
@@ -458,6 +462,228 @@ inline void convertChannels(float *output, size_t outputChannels, const float *i
 }
 }
 
+namespace
+{
+atomic<size_t> audioDataMemorySize(0);
+
+/** allocates zeroed sample memory that is counted until it's freed */
+shared_ptr<void> allocateSampleMemory(size_t byteCount)
+{
+    void *memory = nullptr;
+    if(0 != posix_memalign(&memory, AudioData::alignment, byteCount))
+        throw bad_alloc();
+    addAudioDataMemorySize(byteCount);
+    shared_ptr<void> retval(memory, [byteCount](void *memory)
+    {
+        free(memory);
+        addAudioDataMemorySize(-(ptrdiff_t)byteCount);
+    });
+    fill_n((char *)memory, byteCount, 0);
+    return retval;
+}
+
+template <typename T>
+void quantizeChannel(T *output, const float *input, size_t frameCount, float inverseScale, int32_t maxValue)
+{
+    for(size_t i = 0; i < frameCount; i++)
+    {
+        int32_t value = (int32_t)max<float>(min<float>(round(input[i] * inverseScale), maxValue), -maxValue);
+        output[i] = (T)value;
+    }
+}
+
+void quantizeChannel(Int24Sample *output, const float *input, size_t frameCount, float inverseScale, int32_t maxValue)
+{
+    for(size_t i = 0; i < frameCount; i++)
+    {
+        int32_t value = (int32_t)max<float>(min<float>(round(input[i] * inverseScale), maxValue), -maxValue);
+        output[i].bytes[0] = (uint8_t)value;
+        output[i].bytes[1] = (uint8_t)(value >> 8);
+        output[i].bytes[2] = (uint8_t)(value >> 16);
+    }
+}
+}
+
+namespace
+{
+constexpr int halfBandRadius = 31;
+
+/** a Blackman windowed half band low pass filter; only tap 0 and the odd taps aren't 0 */
+struct HalfBandFilter
+{
+    float taps[halfBandRadius + 1];
+    HalfBandFilter()
+    {
+        double values[halfBandRadius + 1];
+        double sum = 0;
+        for(int i = 0; i <= halfBandRadius; i++)
+        {
+            double x = M_PI * i / (halfBandRadius + 1);
+            double window = 0.42 + 0.5 * cos(x) + 0.08 * cos(2 * x);
+            values[i] = (i == 0 ? 0.5 : sin(M_PI * i / 2) / (M_PI * i)) * window;
+            sum += (i == 0 ? 1 : 2) * values[i];
+        }
+        for(int i = 0; i <= halfBandRadius; i++)
+            taps[i] = (float)(values[i] / sum);
+    }
+};
+
+/** reads a float sample, continuing looped data through its loop and silence elsewhere */
+float readFilterInput(const AudioData &source, size_t channel, ptrdiff_t frame)
+{
+    if(frame < 0)
+        return 0;
+    if((size_t)frame >= source.frameCount)
+    {
+        if(!source.looped || source.loopStart >= source.frameCount)
+            return 0;
+        frame = source.loopStart + (frame - source.frameCount) % (source.frameCount - source.loopStart);
+    }
+    return source.channels[channel][frame];
+}
+
+shared_ptr<AudioData> makeHalfRate(const AudioData &source)
+{
+    static const HalfBandFilter filter;
+    shared_ptr<AudioData> retval = make_shared<AudioData>();
+    retval->sampleRate = source.sampleRate / 2;
+    retval->looped = source.looped;
+    retval->loopStart = source.loopStart / 2;
+    retval->loopDecayAmplitude = source.loopDecayAmplitude;
+    retval->resize((source.frameCount + 1) / 2);
+    for(size_t channel = 0; channel < audioChannelCount; channel++)
+    {
+        const float *input = source.channels[channel];
+        float *output = retval->getWritableChannel(channel);
+        for(size_t i = 0; i < retval->frameCount; i++)
+        {
+            ptrdiff_t center = 2 * i;
+            float sum = filter.taps[0] * input[center];
+            if(center >= halfBandRadius && center + halfBandRadius < (ptrdiff_t)source.frameCount)
+            {
+                for(int tap = 1; tap <= halfBandRadius; tap += 2)
+                    sum += filter.taps[tap] * (input[center - tap] + input[center + tap]);
+            }
+            else
+            {
+                for(int tap = 1; tap <= halfBandRadius; tap += 2)
+                    sum += filter.taps[tap] * (readFilterInput(source, channel, center - tap) + readFilterInput(source, channel, center + tap));
+            }
+            output[i] = sum;
+        }
+    }
+    retval->peak = retval->computePeak();
+    return retval;
+}
+}
+
+std::size_t getAudioDataMemorySize()
+{
+    return audioDataMemorySize.load(memory_order_relaxed);
+}
+
+void addAudioDataMemorySize(std::ptrdiff_t byteCount)
+{
+    audioDataMemorySize.fetch_add((size_t)byteCount, memory_order_relaxed);
+}
+
+constexpr std::size_t AudioData::alignment;
+constexpr std::size_t AudioData::paddingFrames;
+
+void AudioData::resize(std::size_t newFrameCount)
+{
+    assert(sampleFormat == SampleFormat::Float32);
+    if(newFrameCount + paddingFrames <= channelStride)
+    {
+        if(newFrameCount < frameCount)
+        {
+            for(size_t channel = 0; channel < audioChannelCount; channel++)
+                fill(getWritableChannel(channel) + newFrameCount, getWritableChannel(channel) + frameCount, 0.0f);
+        }
+        frameCount = newFrameCount;
+        residentFrameCount = newFrameCount;
+        return;
+    }
+    const size_t alignmentFrames = alignment / sizeof(float);
+    size_t newChannelStride = (newFrameCount + paddingFrames + alignmentFrames - 1) / alignmentFrames * alignmentFrames;
+    shared_ptr<void> newStorage = allocateSampleMemory(newChannelStride * audioChannelCount * sizeof(float));
+    float *newChannel = (float *)newStorage.get();
+    for(const float *&channel : channels)
+    {
+        if(frameCount > 0)
+            copy(channel, channel + frameCount, newChannel);
+        channel = newChannel;
+        newChannel += newChannelStride;
+    }
+    storage = std::move(newStorage);
+    channelStride = newChannelStride;
+    frameCount = newFrameCount;
+    residentFrameCount = newFrameCount;
+}
+
+float AudioData::computePeak() const
+{
+    float retval = 0;
+    for(size_t channel = 0; channel < audioChannelCount; channel++)
+    {
+        for(size_t i = 0; i < residentFrameCount; i++)
+            retval = max(retval, abs(getSample(channel, i)));
+    }
+    return retval;
+}
+
+void AudioData::convert(SampleFormat newSampleFormat)
+{
+    if(newSampleFormat == sampleFormat || stream)
+        return;
+    assert(sampleFormat == SampleFormat::Float32);
+    for(const shared_ptr<AudioData> &mipLevel : mipLevels)
+        mipLevel->convert(newSampleFormat);
+    int32_t maxValue = newSampleFormat == SampleFormat::Int16 ? 0x7FFF : 0x7FFFFF;
+    float maxMagnitude = computePeak();
+    float newSampleScale = maxMagnitude > 0 ? maxMagnitude / maxValue : 1.0f / maxValue;
+    size_t bytesPerSample = getBytesPerSample(newSampleFormat);
+    // keep every channel aligned
+    size_t strideAlignment = alignment;
+    while(strideAlignment % bytesPerSample != 0)
+        strideAlignment += alignment;
+    size_t alignmentFrames = strideAlignment / bytesPerSample;
+    size_t newChannelStride = (residentFrameCount + paddingFrames + alignmentFrames - 1) / alignmentFrames * alignmentFrames;
+    shared_ptr<void> newStorage = allocateSampleMemory(newChannelStride * audioChannelCount * bytesPerSample);
+    char *newChannel = (char *)newStorage.get();
+    for(size_t channel = 0; channel < audioChannelCount; channel++)
+    {
+        if(newSampleFormat == SampleFormat::Int16)
+            quantizeChannel((int16_t *)newChannel, channels[channel], residentFrameCount, 1 / newSampleScale, maxValue);
+        else
+            quantizeChannel((Int24Sample *)newChannel, channels[channel], residentFrameCount, 1 / newSampleScale, maxValue);
+        compactChannels[channel] = newChannel;
+        channels[channel] = nullptr;
+        newChannel += newChannelStride * bytesPerSample;
+    }
+    storage = std::move(newStorage);
+    channelStride = newChannelStride;
+    sampleFormat = newSampleFormat;
+    sampleScale = newSampleScale;
+}
+
+void AudioData::buildMipLevels(std::size_t levelCount)
+{
+    mipLevels.clear();
+    if(stream)
+        return;
+    assert(sampleFormat == SampleFormat::Float32);
+    const AudioData *source = this;
+    while(mipLevels.size() < levelCount && source->frameCount >= 2)
+    {
+        // a loop of an odd number of frames would drift against the loop of the full rate data
+        if(source->looped && (source->frameCount % 2 != 0 || source->loopStart % 2 != 0))
+            break;
+        mipLevels.push_back(makeHalfRate(*source));
+        source = mipLevels.back().get();
+    }
+}
+
 std::shared_ptr<AudioData> loadFromOgg(std::string fileName)
 {
     OggVorbis_File ovf;
@@ -477,7 +703,8 @@ std::shared_ptr<AudioData> loadFromOgg(std::string fileName)
     retval->sampleRate = info->rate;
     auto sampleCount = ov_pcm_total(&ovf, -1);
     if(sampleCount != OV_EINVAL)
-        retval->data.reserve(sampleCount);
+        retval->resize(sampleCount);
+    size_t frameCount = 0;
     vector<float> inputSampleBuffer;
     inputSampleBuffer.resize(inputChannelCount);
     for(;;)
@@ -487,7 +714,8 @@ std::shared_ptr<AudioData> loadFromOgg(std::string fileName)
         long currentSampleCount = ov_read_float(&ovf, &pcmChannels, 8192, &currentSection);
         if(currentSampleCount <= 0)
             break;
-        retval->data.reserve(retval->data.size() + (size_t)currentSampleCount);
+        if(frameCount + (size_t)currentSampleCount > retval->frameCount)
+            retval->resize(max(frameCount + (size_t)currentSampleCount, 2 * retval->frameCount));
         for(size_t sample = 0; sample < (size_t)currentSampleCount; sample++)
         {
             for(int i = 0; i < inputChannelCount; i++)
@@ -496,9 +724,15 @@ std::shared_ptr<AudioData> loadFromOgg(std::string fileName)
             }
             array_AudioChannel<float> outputSample;
             convertChannels(&outputSample[0], outputSample.size(), &inputSampleBuffer[0], inputChannelCount);
-            retval->data.push_back(outputSample);
+            for(size_t channel = 0; channel < audioChannelCount; channel++)
+            {
+                retval->getWritableChannel(channel)[frameCount] = outputSample[channel];
+            }
+            frameCount++;
         }
     }
     ov_clear(&ovf);
-    return std::move(retval);
+    retval->resize(frameCount);
+    retval->peak = retval->computePeak();
+    return retval;
 }
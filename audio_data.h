@@ -2,19 +2,162 @@
 #define AUDIO_DATA_H_INCLUDED
 
 #include <vector>
+#include <cmath>
+#include <cstdint>
 #include "audio_channel.h"
 #include <string>
 #include <memory>
 
+struct AudioDataStream;
+
+/** @brief a packed little endian 24 bit sample */
+struct Int24Sample
+{
+    std::uint8_t bytes[3];
+    operator std::int32_t() const
+    {
+        // shift the sign bit to the top then back down to sign extend
+        return (std::int32_t)((std::uint32_t)bytes[0] << 8 | (std::uint32_t)bytes[1] << 16 | (std::uint32_t)bytes[2] << 24) >> 8;
+    }
+};
+
+static_assert(sizeof(Int24Sample) == 3, "24 bit samples have to be packed");
+
+/** @brief planar sample data
+ *
+ * Each channel is a separate buffer aligned to AudioData::alignment bytes.
+ * At least AudioData::paddingFrames zero frames follow the end of every resident channel
+ * so vector loads can read past the last frame.
+ *
+ * Samples are floats in channels or, to save memory, integers in compactChannels
+ * that are multiplied by sampleScale when read.
+ *
+ * Streamed data only keeps the first residentFrameCount frames in memory;
+ * the rest is read from stream by a DiskStreamer while playing.
+ *
+ * mipLevels can hold band limited copies at a half, a quarter and so on of the sample rate
+ * for playing far above the original pitch. Frame i of level k lines up with frame i << (k + 1).
+ */
 struct AudioData
 {
-    std::vector<array_AudioChannel<float>> data;
+    static constexpr std::size_t alignment = 64;
+    static constexpr std::size_t paddingFrames = 16;
+    enum class SampleFormat
+    {
+        Float32,
+        Int16,
+        Int24,
+    };
+    /** the float channels, or nullptr when the samples are stored as integers */
+    array_AudioChannel<const float *> channels;
+    /** the int16_t or Int24Sample channels, or nullptr when the samples are stored as floats */
+    array_AudioChannel<const void *> compactChannels;
+    SampleFormat sampleFormat;
+    /** the sample value of a stored integer of 1 */
+    float sampleScale;
+    std::size_t frameCount;
+    std::size_t residentFrameCount;
+    std::size_t channelStride;
+    std::shared_ptr<void> storage;
+    std::shared_ptr<AudioDataStream> stream;
     double sampleRate;
     size_t loopStart;
     bool looped;
     float loopDecayAmplitude;
+    /** the largest sample magnitude or INFINITY if it isn't known */
+    float peak;
+    /** the band limited copies at half the sample rate of the one before, built by buildMipLevels */
+    std::vector<std::shared_ptr<AudioData>> mipLevels;
+    AudioData()
+        : sampleFormat(SampleFormat::Float32), sampleScale(1), frameCount(0), residentFrameCount(0), channelStride(0), sampleRate(0), loopStart(0), looped(false), loopDecayAmplitude(1), peak(INFINITY)
+    {
+        channels.fill(nullptr);
+        compactChannels.fill(nullptr);
+    }
+    static std::size_t getBytesPerSample(SampleFormat sampleFormat)
+    {
+        switch(sampleFormat)
+        {
+        case SampleFormat::Float32:
+            return sizeof(float);
+        case SampleFormat::Int16:
+            return sizeof(std::int16_t);
+        case SampleFormat::Int24:
+            return sizeof(Int24Sample);
+        }
+        return 0;
+    }
+    /** @brief read a resident sample in any format
+     */
+    float getSample(std::size_t channel, std::size_t frame) const
+    {
+        switch(sampleFormat)
+        {
+        case SampleFormat::Float32:
+            break;
+        case SampleFormat::Int16:
+            return sampleScale * ((const std::int16_t *)compactChannels[channel])[frame];
+        case SampleFormat::Int24:
+            return sampleScale * (std::int32_t)((const Int24Sample *)compactChannels[channel])[frame];
+        }
+        return channels[channel][frame];
+    }
+    /** @brief get a float channel to write to
+     *
+     * Only for samples allocated by resize; the channels of a mapped sample bank are read only.
+     */
+    float *getWritableChannel(std::size_t channel)
+    {
+        return const_cast<float *>(channels[channel]);
+    }
+    /** @brief resize every channel
+     *
+     * New frames are zero. Growing past the allocated space reallocates the channels.
+     * Makes every frame resident; streamed data, mapped data and integer samples can't be resized.
+     *
+     * @param newFrameCount the new number of frames
+     *
+     */
+    void resize(std::size_t newFrameCount);
+    /** @brief convert float samples to another format
+     *
+     * Integer samples are scaled so the peak uses their whole range.
+     * Streamed data stays float because its stream is read as floats.
+     *
+     * @param newSampleFormat the format to store the samples as
+     *
+     */
+    void convert(SampleFormat newSampleFormat);
+    /** @brief build band limited half rate copies of float samples
+     *
+     * Each level is low pass filtered and decimated from the one before,
+     * so the levels together take nearly as much memory again as the data.
+     * Looped data stops at the first level whose loop wouldn't start and end on whole frames,
+     * and streamed data gets no levels because they would have to be resident.
+     * Converting afterwards converts the levels too.
+     *
+     * @param levelCount the most levels to build; 0 removes the levels
+     *
+     */
+    void buildMipLevels(std::size_t levelCount);
+    /** @brief find the largest sample magnitude of the resident frames
+     */
+    float computePeak() const;
 };
 
 std::shared_ptr<AudioData> loadFromOgg(std::string fileName);
 
+/** @brief get the bytes of memory holding sample data
+ *
+ * Counts the storage allocated by AudioData::resize and anything added with addAudioDataMemorySize.
+ */
+std::size_t getAudioDataMemorySize();
+
+/** @brief count sample data memory that isn't allocated by AudioData::resize, like a mapped sample bank
+ *
+ * @param byteCount the bytes allocated, or negative for the bytes freed
+ *
+ */
+void addAudioDataMemorySize(std::ptrdiff_t byteCount);
+
 #endif // AUDIO_DATA_H_INCLUDED
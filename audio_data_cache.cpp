@@ -0,0 +1,206 @@
+#include "audio_data_cache.h"
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace
+{
+/** FNV-1a */
+uint64_t hashFile(const string &fileName)
+{
+    ifstream is(fileName.c_str(), ios::binary);
+    if(!is)
+        throw runtime_error("can't open file : " + fileName);
+    uint64_t retval = 0xCBF29CE484222325ULL;
+    vector<char> buffer(1 << 16);
+    while(is)
+    {
+        is.read(&buffer[0], buffer.size());
+        for(streamsize i = 0, readCount = is.gcount(); i < readCount; i++)
+        {
+            retval ^= (unsigned char)buffer[i];
+            retval *= 0x100000001B3ULL;
+        }
+    }
+    if(!is.eof())
+        throw runtime_error("can't read file : " + fileName);
+    return retval;
+}
+
+string getCanonicalPath(const string &fileName)
+{
+    char *path = realpath(fileName.c_str(), nullptr);
+    if(path == nullptr)
+        throw runtime_error("can't open file : " + fileName);
+    string retval = path;
+    free(path);
+    return retval;
+}
+
+size_t getMemorySize(const AudioData &audioData)
+{
+    size_t retval = audioData.channelStride * audioChannelCount * AudioData::getBytesPerSample(audioData.sampleFormat);
+    for(const shared_ptr<AudioData> &mipLevel : audioData.mipLevels)
+        retval += getMemorySize(*mipLevel);
+    return retval;
+}
+
+bool ready(const shared_future<shared_ptr<AudioData>> &audioData)
+{
+    return audioData.wait_for(chrono::seconds(0)) == future_status::ready;
+}
+}
+
+constexpr std::size_t AudioDataCache::unlimited;
+constexpr std::size_t AudioDataCache::defaultMemoryBudget;
+
+AudioDataCache::AudioDataCache(std::size_t memoryBudget)
+    : memoryBudget(memoryBudget), memorySize(0), hitCount(0), missCount(0), evictionCount(0)
+{
+}
+
+AudioDataCache &AudioDataCache::getDefault()
+{
+    static AudioDataCache retval(defaultMemoryBudget);
+    return retval;
+}
+
+std::size_t AudioDataCache::getMemoryBudget() const
+{
+    unique_lock<mutex> lockIt(lock);
+    return memoryBudget;
+}
+
+void AudioDataCache::setMemoryBudget(std::size_t memoryBudget)
+{
+    unique_lock<mutex> lockIt(lock);
+    this->memoryBudget = memoryBudget;
+    evict();
+}
+
+AudioDataCache::FileIdentity AudioDataCache::getFileIdentity(const std::string &canonicalPath)
+{
+    struct stat st;
+    if(stat(canonicalPath.c_str(), &st) != 0)
+        throw runtime_error("can't open file : " + canonicalPath);
+    FileIdentity retval;
+    retval.modificationTime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    retval.fileSize = st.st_size;
+    {
+        unique_lock<mutex> lockIt(lock);
+        auto i = fileIdentities.find(canonicalPath);
+        if(i != fileIdentities.end() && i->second.modificationTime == retval.modificationTime && i->second.fileSize == retval.fileSize)
+            return i->second;
+    }
+    // hash without holding the lock so other files can be loaded meanwhile
+    retval.contentHash = hashFile(canonicalPath);
+    unique_lock<mutex> lockIt(lock);
+    fileIdentities[canonicalPath] = retval;
+    return retval;
+}
+
+void AudioDataCache::evict()
+{
+    if(memoryBudget == unlimited)
+        return;
+    for(auto i = entries.end(); memorySize > memoryBudget && i != entries.begin();)
+    {
+        --i;
+        // entries still decoding or in use stay
+        if(!ready(i->audioData) || i->audioData.get().use_count() > 1)
+            continue;
+        memorySize -= i->memorySize;
+        entryIndex.erase(i->key);
+        i = entries.erase(i);
+        evictionCount++;
+    }
+}
+
+std::shared_ptr<AudioData> AudioDataCache::load(const std::string &fileName, std::size_t loopStart, std::size_t loopEnd, AudioData::SampleFormat sampleFormat, std::size_t mipLevelCount)
+{
+    Key key;
+    {
+        FileIdentity identity = getFileIdentity(getCanonicalPath(fileName));
+        key = Key(identity.contentHash, identity.fileSize, loopStart, loopEnd, sampleFormat, mipLevelCount);
+    }
+    promise<shared_ptr<AudioData>> decoded;
+    {
+        unique_lock<mutex> lockIt(lock);
+        auto i = entryIndex.find(key);
+        if(i != entryIndex.end())
+        {
+            hitCount++;
+            entries.splice(entries.begin(), entries, i->second);
+            shared_future<shared_ptr<AudioData>> audioData = i->second->audioData;
+            lockIt.unlock();
+            // waits if another thread is still decoding it
+            return audioData.get();
+        }
+        missCount++;
+        entries.push_front(Entry{key, decoded.get_future().share(), 0});
+        entryIndex[key] = entries.begin();
+    }
+    shared_ptr<AudioData> audioData;
+    try
+    {
+        audioData = loadFromOgg(fileName);
+        if(loopEnd > 0)
+        {
+            audioData->resize(loopEnd);
+            audioData->looped = true;
+            audioData->loopStart = loopStart;
+        }
+        audioData->buildMipLevels(mipLevelCount);
+        audioData->convert(sampleFormat);
+    }
+    catch(...)
+    {
+        decoded.set_exception(current_exception());
+        unique_lock<mutex> lockIt(lock);
+        auto i = entryIndex.find(key);
+        if(i != entryIndex.end())
+        {
+            entries.erase(i->second);
+            entryIndex.erase(i);
+        }
+        throw;
+    }
+    decoded.set_value(audioData);
+    unique_lock<mutex> lockIt(lock);
+    auto i = entryIndex.find(key);
+    if(i != entryIndex.end())
+    {
+        i->second->memorySize = getMemorySize(*audioData);
+        memorySize += i->second->memorySize;
+        evict();
+    }
+    return audioData;
+}
+
+void AudioDataCache::clear()
+{
+    unique_lock<mutex> lockIt(lock);
+    size_t savedMemoryBudget = memoryBudget;
+    // a budget of one byte evicts everything that can be evicted
+    memoryBudget = 1;
+    evict();
+    memoryBudget = savedMemoryBudget;
+}
+
+AudioDataCache::Statistics AudioDataCache::getStatistics() const
+{
+    unique_lock<mutex> lockIt(lock);
+    Statistics retval;
+    retval.hitCount = hitCount;
+    retval.missCount = missCount;
+    retval.evictionCount = evictionCount;
+    retval.entryCount = entries.size();
+    retval.memorySize = memorySize;
+    retval.memoryBudget = memoryBudget;
+    return retval;
+}
@@ -0,0 +1,109 @@
+#ifndef AUDIO_DATA_CACHE_H_INCLUDED
+#define AUDIO_DATA_CACHE_H_INCLUDED
+
+#include "audio_data.h"
+#include <cstdint>
+#include <future>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+/** @brief shares decoded audio files between every instrument that uses them
+ *
+ * Files are identified by their contents, so the same audio is decoded once
+ * even when it is reached through different paths or copied between instruments.
+ * A file is only hashed again when its canonical path, modification time or size changes.
+ *
+ * Entries that no instrument uses any more are kept for later loads and evicted least recently used first
+ * when the cache grows past its memory budget. Entries still in use are never evicted,
+ * so the cache can exceed its budget while they are.
+ *
+ * Safe to use from several threads; concurrent loads of the same file decode it once.
+ */
+class AudioDataCache
+{
+public:
+    static constexpr std::size_t unlimited = 0;
+    /** the memory budget of the cache shared by the whole process */
+    static constexpr std::size_t defaultMemoryBudget = (std::size_t)256 << 20;
+    struct Statistics
+    {
+        std::uint64_t hitCount;
+        std::uint64_t missCount;
+        std::uint64_t evictionCount;
+        std::size_t entryCount;
+        /** the bytes of decoded audio held by the cache, in use or not */
+        std::size_t memorySize;
+        std::size_t memoryBudget;
+    };
+private:
+    struct FileIdentity
+    {
+        std::int64_t modificationTime;
+        std::uint64_t fileSize;
+        std::uint64_t contentHash;
+    };
+    /** content hash, file size, loop start, loop end, sample format and mip level count */
+    typedef std::tuple<std::uint64_t, std::uint64_t, std::size_t, std::size_t, AudioData::SampleFormat, std::size_t> Key;
+    struct Entry
+    {
+        Key key;
+        std::shared_future<std::shared_ptr<AudioData>> audioData;
+        std::size_t memorySize;
+    };
+    mutable std::mutex lock;
+    std::map<std::string, FileIdentity> fileIdentities;
+    /** most recently used first */
+    std::list<Entry> entries;
+    std::map<Key, std::list<Entry>::iterator> entryIndex;
+    std::size_t memoryBudget;
+    std::size_t memorySize;
+    std::uint64_t hitCount;
+    std::uint64_t missCount;
+    std::uint64_t evictionCount;
+    FileIdentity getFileIdentity(const std::string &canonicalPath);
+    void evict();
+public:
+    /** @brief construct an audio data cache
+     *
+     * @param memoryBudget the bytes of decoded audio to keep or unlimited
+     *
+     */
+    explicit AudioDataCache(std::size_t memoryBudget = unlimited);
+    AudioDataCache(const AudioDataCache &) = delete;
+    const AudioDataCache &operator =(const AudioDataCache &) = delete;
+    /** @brief get the cache shared by the whole process
+     *
+     * Its memory budget starts at defaultMemoryBudget.
+     */
+    static AudioDataCache &getDefault();
+    std::size_t getMemoryBudget() const;
+    /** @brief set the memory budget, evicting unused entries to fit
+     *
+     * @param memoryBudget the bytes of decoded audio to keep or unlimited
+     *
+     */
+    void setMemoryBudget(std::size_t memoryBudget);
+    /** @brief load an Ogg/Vorbis file, decoding it only if it isn't cached
+     *
+     * The returned audio data is shared and must not be modified.
+     *
+     * @param fileName the file to load
+     * @param loopStart the first frame of the loop
+     * @param loopEnd the frame the loop ends at, which the audio is cut to, or 0 for audio that doesn't loop
+     * @param sampleFormat the format to store the samples as
+     * @param mipLevelCount the most band limited levels to build with AudioData::buildMipLevels
+     * @return the decoded audio data
+     * @throw std::runtime_error if the file can't be read or decoded
+     *
+     */
+    std::shared_ptr<AudioData> load(const std::string &fileName, std::size_t loopStart = 0, std::size_t loopEnd = 0, AudioData::SampleFormat sampleFormat = AudioData::SampleFormat::Float32, std::size_t mipLevelCount = 0);
+    /** @brief evict every entry that isn't in use
+     */
+    void clear();
+    Statistics getStatistics() const;
+};
+
+#endif // AUDIO_DATA_CACHE_H_INCLUDED
@@ -1,5 +1,9 @@
 #include "audio_output.h"
+#include "lock_free_queue.h"
+#include "sample_conversion.h"
 #include <SDL.h>
+#include <pthread.h>
+#include <sched.h>
 #include <cstdlib>
 #include <cstdint>
 #include <stdexcept>
@@ -8,9 +12,11 @@
 #include <string>
 #include <cstring>
 #include <vector>
-#include <limits>
 #include <cassert>
 #include <iostream>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
 
 using namespace std;
 
@@ -24,32 +30,117 @@ class DeviceAudioOutput : public AudioOutput
     mutex sourceLock;
     SDL_AudioSpec audioSpec;
     SDL_AudioDeviceID audioDeviceID;
+    size_t renderBlockFrameCount;
+    size_t renderAheadFrameCount;
+    /** rendered samples waiting for the device; sized once the device has picked its period */
+    unique_ptr<SpscRingBuffer<float>> ring;
+    vector<float> renderBuffer;
+    /** samples read out of the ring to convert to an integer device format */
     vector<float> buffer;
-    void fillBuffer(uint8_t *buffer_in, int length)
+    shared_ptr<RenderStatistics> statistics;
+    bool ditherEnabled;
+    TpdfDither dither;
+    thread renderThread;
+    atomic_bool done;
+    mutex wakeLock;
+    condition_variable wakeCondition;
+    static void setRealtimePriority()
     {
-        int16_t *buffer16 = (int16_t *)buffer_in;
-        memset((void *)buffer16, 0, length);
-        assert(length % (((size_t)AudioChannel::Last + 1) * sizeof(int16_t)) == 0);
-        size_t sampleCount = length / (((size_t)AudioChannel::Last + 1) * sizeof(int16_t));
-        buffer.assign(sampleCount * ((size_t)AudioChannel::Last + 1), 0);
-        unique_lock<mutex> lockIt(sourceLock);
+        // best effort: without permission the render thread stays at normal priority
+        sched_param param;
+        param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+        pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    }
+    void renderBlock()
+    {
+        auto startTime = chrono::steady_clock::now();
+        // wait for a control thread holding the lock; the samples rendered ahead keep the device playing meanwhile
+        unique_lock<mutex> lockIt(sourceLock, try_to_lock);
+        if(!lockIt.owns_lock())
+        {
+            if(statistics)
+                statistics->recordLockWait();
+            lockIt.lock();
+        }
         double sampleDuration = 1.0 / audioSpec.freq;
-        auto bufferIterator = buffer.begin();
-        for(size_t sample = 0; sample < sampleCount; sample++)
+        if(source)
+            source->render(&renderBuffer[0], renderBlockFrameCount, sampleDuration);
+        else
+            fill(renderBuffer.begin(), renderBuffer.end(), 0.0f);
+        lockIt.unlock();
+        ring->write(&renderBuffer[0], renderBuffer.size());
+        if(statistics)
         {
-            for(size_t channel = 0; channel <= (size_t)AudioChannel::Last; channel++)
+            // the block has to be rendered in the time it plays for rendering to keep up
+            double duration = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+            statistics->recordCallback(duration, renderBlockFrameCount * sampleDuration);
+        }
+    }
+    void renderMain()
+    {
+        setRealtimePriority();
+        size_t aheadSampleCount = renderAheadFrameCount * audioChannelCount;
+        auto blockDuration = chrono::duration<double>((double)renderBlockFrameCount / audioSpec.freq);
+        while(!done.load(memory_order_acquire))
+        {
+            size_t bufferedSampleCount = ring->capacity() - ring->getWritableCount();
+            if(bufferedSampleCount + renderBuffer.size() <= aheadSampleCount)
             {
-                *bufferIterator++ = source->getCurrentSample((AudioChannel)channel);
+                renderBlock();
+                continue;
             }
-            source->advanceTime(sampleDuration);
+            // the callback wakes us after taking samples; the timeout covers a missed wake up
+            unique_lock<mutex> lockIt(wakeLock);
+            wakeCondition.wait_for(lockIt, blockDuration);
         }
-        lockIt.unlock();
-        for(float fv : buffer)
+    }
+    size_t getBytesPerSample() const
+    {
+        return audioSpec.format == AUDIO_S16SYS ? sizeof(int16_t) : sizeof(float);
+    }
+    /** @brief read samples out of the ring into an integer device format
+     *
+     * Converts through buffer a piece at a time, so the callback never allocates.
+     *
+     * @return the number of samples read
+     *
+     */
+    size_t readConverted(uint8_t *output, size_t sampleCount)
+    {
+        size_t readCount = 0;
+        while(readCount < sampleCount)
         {
-            int v = (int)(fv * 0x8000);
-            v = max<int>(v, numeric_limits<int16_t>::min());
-            v = min<int>(v, numeric_limits<int16_t>::max());
-            *buffer16++ = v;
+            size_t requestedCount = min(sampleCount - readCount, buffer.size());
+            size_t count = ring->read(&buffer[0], requestedCount);
+            if(audioSpec.format == AUDIO_S16SYS)
+                convertToInt16((int16_t *)output + readCount, &buffer[0], count, ditherEnabled ? &dither : nullptr);
+            else
+                convertToInt32((int32_t *)output + readCount, &buffer[0], count);
+            readCount += count;
+            if(count < requestedCount)
+                break;
+        }
+        return readCount;
+    }
+    void fillBuffer(uint8_t *buffer_in, int length)
+    {
+        size_t bytesPerSample = getBytesPerSample();
+        assert(length % (audioChannelCount * bytesPerSample) == 0);
+        size_t sampleCount = length / bytesPerSample;
+        if(sampleCount == 0)
+            return;
+        size_t readCount;
+        if(audioSpec.format == AUDIO_F32SYS)
+            readCount = ring->read((float *)buffer_in, sampleCount);
+        else
+            readCount = readConverted(buffer_in, sampleCount);
+        wakeCondition.notify_one();
+        if(readCount < sampleCount)
+        {
+            // zero is silence in every format used
+            memset(buffer_in + readCount * bytesPerSample, 0, (sampleCount - readCount) * bytesPerSample);
+            if(statistics)
+                statistics->recordUnderrun();
         }
     }
     static void audioCallback(void *user_data, uint8_t *buffer_in, int length)
@@ -57,8 +148,12 @@ class DeviceAudioOutput : public AudioOutput
         ((DeviceAudioOutput *)user_data)->fillBuffer(buffer_in, length);
     }
 public:
-    DeviceAudioOutput()
+    DeviceAudioOutput(shared_ptr<RenderStatistics> statistics, size_t periodFrameCount, size_t renderBlockFrameCount, size_t renderAheadFrameCount, DeviceSampleFormat sampleFormat, bool dither)
+        : audioDeviceID(0), renderBlockFrameCount(renderBlockFrameCount), renderAheadFrameCount(renderAheadFrameCount),
+          statistics(std::move(statistics)), ditherEnabled(dither), done(false)
     {
+        if(periodFrameCount == 0 || periodFrameCount > 0x8000 || renderBlockFrameCount == 0)
+            throw runtime_error("invalid audio buffer size");
         if(deviceAudioOutputUsed.exchange(true))
             throw runtime_error("device audio already in use");
         try
@@ -70,11 +165,29 @@ public:
                 SDL_AudioSpec desired;
                 desired.callback = &audioCallback;
                 desired.channels = (size_t)AudioChannel::Last + 1;
-                desired.format = AUDIO_S16SYS;
+                switch(sampleFormat)
+                {
+                case DeviceSampleFormat::Float32:
+                    desired.format = AUDIO_F32SYS;
+                    break;
+                case DeviceSampleFormat::Int16:
+                    desired.format = AUDIO_S16SYS;
+                    break;
+                case DeviceSampleFormat::Int32:
+                    desired.format = AUDIO_S32SYS;
+                    break;
+                }
                 desired.freq = 44100;
-                desired.samples = 4096;
+                desired.samples = periodFrameCount;
                 desired.userdata = (void *)this;
-                audioDeviceID = SDL_OpenAudioDevice(nullptr, 0, &desired, &audioSpec, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+                audioDeviceID = SDL_OpenAudioDevice(nullptr, 0, &desired, &audioSpec, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_FORMAT_CHANGE);
+                if(audioDeviceID != 0 && audioSpec.format != AUDIO_F32SYS && audioSpec.format != AUDIO_S16SYS && audioSpec.format != AUDIO_S32SYS)
+                {
+                    // a format we don't convert to; let SDL convert from 16 bit instead
+                    SDL_CloseAudioDevice(audioDeviceID);
+                    desired.format = AUDIO_S16SYS;
+                    audioDeviceID = SDL_OpenAudioDevice(nullptr, 0, &desired, &audioSpec, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+                }
                 if(audioDeviceID == 0)
                     throw runtime_error(string("SDL_OpenAudioDevice failed: ") + SDL_GetError());
                 switch(audioSpec.channels)
@@ -106,11 +219,29 @@ public:
                 default:
                     cout << (int)audioSpec.channels << "-channel";
                 }
-                cout << " at " << audioSpec.freq / 1000.0 << "kHz\n";
+                cout << " at " << audioSpec.freq / 1000.0 << "kHz";
+                if(audioSpec.format == AUDIO_F32SYS)
+                    cout << ", float\n";
+                else if(audioSpec.format == AUDIO_S32SYS)
+                    cout << ", 32 bit\n";
+                else
+                    cout << ", 16 bit" << (ditherEnabled ? " dithered\n" : "\n");
+                // whole periods have to be rendered ahead to never run dry, and the device may pick a longer period than asked for
+                this->renderAheadFrameCount = max<size_t>(this->renderAheadFrameCount, audioSpec.samples + renderBlockFrameCount);
+                ring.reset(new SpscRingBuffer<float>(this->renderAheadFrameCount * audioChannelCount));
+                renderBuffer.resize(renderBlockFrameCount * audioChannelCount);
+                if(audioSpec.format != AUDIO_F32SYS)
+                    buffer.resize(audioSpec.samples * audioChannelCount);
+                renderThread = thread([this]()
+                {
+                    renderMain();
+                });
                 SDL_PauseAudioDevice(audioDeviceID, SDL_FALSE);
             }
             catch(...)
             {
+                if(audioDeviceID != 0)
+                    SDL_CloseAudioDevice(audioDeviceID);
                 SDL_Quit();
                 throw;
             }
@@ -125,6 +256,9 @@ public:
     {
         SDL_PauseAudioDevice(audioDeviceID, SDL_TRUE);
         SDL_CloseAudioDevice(audioDeviceID);
+        done.store(true, memory_order_release);
+        wakeCondition.notify_one();
+        renderThread.join();
         SDL_Quit();
         deviceAudioOutputUsed.store(false);
     }
@@ -149,7 +283,7 @@ public:
 };
 }
 
-std::unique_ptr<AudioOutput> makeDeviceAudioOutput()
+std::unique_ptr<AudioOutput> makeDeviceAudioOutput(std::shared_ptr<RenderStatistics> statistics, std::size_t periodFrameCount, std::size_t renderBlockFrameCount, std::size_t renderAheadFrameCount, DeviceSampleFormat sampleFormat, bool dither)
 {
-    return unique_ptr<AudioOutput>(new DeviceAudioOutput);
+    return unique_ptr<AudioOutput>(new DeviceAudioOutput(std::move(statistics), periodFrameCount, renderBlockFrameCount, renderAheadFrameCount, sampleFormat, dither));
 }
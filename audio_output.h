@@ -15,11 +15,48 @@ public:
     {
     }
     virtual void bind(std::shared_ptr<AudioSource> src) = 0;
+    /** @brief lock the bound source against rendering
+     *
+     * The render thread waits for the lock, so holding it for longer than is rendered ahead underruns the device.
+     * Prefer posting commands through a CommandSource.
+     */
     virtual void lock() = 0;
     virtual void unlock() = 0;
     virtual bool try_lock() = 0;
 };
 
-std::unique_ptr<AudioOutput> makeDeviceAudioOutput();
+constexpr std::size_t defaultDevicePeriodFrameCount = 512;
+constexpr std::size_t defaultRenderBlockFrameCount = 128;
+constexpr std::size_t defaultRenderAheadFrameCount = 1024;
+
+/** @brief the sample format to ask the audio device for */
+enum class DeviceSampleFormat
+{
+    /** floats handed to the device as rendered, with no conversion */
+    Float32,
+    Int16,
+    Int32,
+};
+
+/** @brief open the default audio device
+ *
+ * A render thread renders the bound source in small blocks into a ring buffer, keeping it renderAheadFrameCount frames ahead,
+ * and the device callback only copies out of the ring. The latency is about the render ahead plus a device period;
+ * a slow block only underruns the device once everything rendered ahead has played.
+ * Statistics are recorded per render block, with the time the block plays as its deadline.
+ *
+ * The device may pick another of the sample formats than the one asked for; any other format it needs is converted from 16 bit by SDL.
+ *
+ * @param statistics the statistics to record render timing in or nullptr
+ * @param periodFrameCount the frames the device asks for at a time
+ * @param renderBlockFrameCount the frames rendered at a time
+ * @param renderAheadFrameCount the frames to keep rendered ahead; raised to at least the period the device picks and a render block
+ * @param sampleFormat the sample format to ask the device for
+ * @param dither whether to add triangular dither when converting to 16 bit
+ * @return the new audio output
+ * @throw std::runtime_error if the device can't be opened or a size is 0
+ *
+ */
+std::unique_ptr<AudioOutput> makeDeviceAudioOutput(std::shared_ptr<RenderStatistics> statistics = nullptr, std::size_t periodFrameCount = defaultDevicePeriodFrameCount, std::size_t renderBlockFrameCount = defaultRenderBlockFrameCount, std::size_t renderAheadFrameCount = defaultRenderAheadFrameCount, DeviceSampleFormat sampleFormat = DeviceSampleFormat::Float32, bool dither = false);
 
 #endif // AUDIO_OUTPUT_H_INCLUDED
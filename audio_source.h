@@ -12,7 +12,12 @@
 #include <cassert>
 #include <list>
 #include <iterator>
+#include <algorithm>
 #include "audio_data.h"
+#include "sample_interpolation.h"
+#include "disk_streamer.h"
+#include "render_thread_pool.h"
+#include "render_statistics.h"
 
 class AudioSource
 {
@@ -28,6 +33,64 @@ public:
     virtual float getCurrentSample(AudioChannel channel) = 0;
     virtual void advanceTime(double deltaTime) = 0;
     virtual std::shared_ptr<AudioSource> duplicate() const = 0;
+    /** @brief copy the state of another source without allocating
+     *
+     * Lets a source made by duplicate() be reused for a later duplicate of the same source.
+     * The default implementation doesn't support assigning.
+     *
+     * @param source a source with the same structure as this one
+     * @return true if the state was copied; on false this source is left in an unspecified state
+     *
+     */
+    virtual bool assign(const AudioSource &source)
+    {
+        return false;
+    }
+    /** @brief release anything held only while playing, like disk streaming voices
+     *
+     * Called when a source is kept around after it stops playing.
+     */
+    virtual void releaseResources()
+    {
+    }
+    /** @brief get a bound on the magnitude of the samples still to come
+     *
+     * Used to retire voices that can't be heard anymore.
+     * The bound only has to hold until the source is changed from outside, like by setting a new amplitude.
+     * The default implementation returns INFINITY for no known bound.
+     *
+     * @return the largest magnitude any later sample can have
+     *
+     */
+    virtual float getPeakBound()
+    {
+        return INFINITY;
+    }
+    /** @brief render a block of audio
+     *
+     * For each frame, writes the current sample of every channel then advances time by frameDuration.
+     * The default implementation calls getCurrentSample and advanceTime for every frame,
+     * so sources only need to override it to avoid the per-sample virtual calls.
+     *
+     * @param output the buffer to write frameCount * audioChannelCount interleaved samples to
+     * @param frameCount the number of frames to render
+     * @param frameDuration the duration of each frame
+     * @return false if every sample written is zero, so the caller can skip mixing the block;
+     *     true if the block may be audible
+     *
+     */
+    virtual bool render(float *output, std::size_t frameCount, double frameDuration)
+    {
+        for(std::size_t frame = 0; frame < frameCount; frame++)
+        {
+            for(std::size_t channel = 0; channel < audioChannelCount; channel++)
+            {
+                *output++ = getCurrentSample((AudioChannel)channel);
+            }
+            advanceTime(frameDuration);
+        }
+        return true;
+    }
 };
 
 class TimeScaleAudioSource : public AudioSource
@@ -38,113 +101,184 @@ public:
         Exponential,
         Linear,
     };
+    static constexpr std::size_t defaultControlInterval = 32;
 private:
     double scale, newScale;
     double scaleSpeed;
+    /** the scale and the target scale along the ramp: the scale itself or its log */
+    double rampPosition, rampTarget;
     std::shared_ptr<AudioSource> source;
     ScaleType scaleType;
+    std::size_t controlInterval;
     static double trapArea(double base, double side1, double side2)
     {
         return base * 0.5 * (side1 + side2);
     }
-    static double expTrapArea(double base, double side1, double side2)
+    static double expTrapArea(double base, double side1, double side2, double logSide1, double logSide2)
     {
-        if(side1 == side2)
+        if(logSide1 == logSide2)
             return rectArea(base, side1);
-        return base * (side1 - side2) / (std::log(side1) - std::log(side2));
+        return base * (side1 - side2) / (logSide1 - logSide2);
     }
     static double rectArea(double base, double side)
     {
         return base * side;
     }
+    double toRamp(double v) const
+    {
+        if(scaleType == ScaleType::Exponential)
+            return std::log(v);
+        return v;
+    }
+    double fromRamp(double v) const
+    {
+        if(scaleType == ScaleType::Exponential)
+            return std::exp(v);
+        return v;
+    }
+    bool ramping() const
+    {
+        return rampPosition != rampTarget && scaleSpeed != 0;
+    }
+    double advanceScale(double deltaTime)
+    {
+        if(!ramping())
+            return deltaTime * scale;
+        double stabilizeTime = getStabilizeTime();
+        double startScale = scale, startPosition = rampPosition;
+        double restArea = 0;
+        if(deltaTime >= stabilizeTime)
+        {
+            restArea = rectArea(deltaTime - stabilizeTime, newScale);
+            deltaTime = stabilizeTime;
+            rampPosition = rampTarget;
+            scale = newScale;
+        }
+        else
+        {
+            rampPosition += sgn(rampTarget - rampPosition) * scaleSpeed * deltaTime;
+            scale = fromRamp(rampPosition);
+        }
+        switch(scaleType)
+        {
+        case ScaleType::Linear:
+            return trapArea(deltaTime, startScale, scale) + restArea;
+        case ScaleType::Exponential:
+            return expTrapArea(deltaTime, startScale, scale, startPosition, rampPosition) + restArea;
+        }
+        assert(false);
+        return 0;
+    }
 public:
     TimeScaleAudioSource(std::shared_ptr<AudioSource> source, double scale = 1.0)
-        : scale(scale), newScale(scale), scaleSpeed(1.0), source(std::move(source)), scaleType(ScaleType::Linear)
+        : scale(scale), newScale(scale), scaleSpeed(1.0), rampPosition(scale), rampTarget(scale), source(std::move(source)), scaleType(ScaleType::Linear), controlInterval(defaultControlInterval)
     {
     }
     double getScale() const
     {
         return scale;
     }
+    /** @brief set the scale without a transition
+     */
+    void resetScale(double scale)
+    {
+        this->scale = scale;
+        newScale = scale;
+        scaleSpeed = 1.0;
+        scaleType = ScaleType::Linear;
+        rampPosition = scale;
+        rampTarget = scale;
+    }
     void setScale(double newScale, double scaleSpeed = 1.0, ScaleType scaleType = ScaleType::Exponential)
     {
         this->newScale = newScale;
         this->scaleSpeed = scaleSpeed;
         this->scaleType = scaleType;
+        // the logs are taken once here instead of on every step of the transition
+        rampPosition = toRamp(scale);
+        rampTarget = toRamp(newScale);
+    }
+    std::size_t getControlInterval() const
+    {
+        return controlInterval;
+    }
+    /** @brief set how often render updates the scale during a transition
+     *
+     * The scale is computed every controlInterval frames and held at the mean over each interval,
+     * so the source's time is exact at the end of every interval.
+     *
+     * @param controlInterval the frames between updates; 1 updates every frame
+     *
+     */
+    void setControlInterval(std::size_t controlInterval)
+    {
+        this->controlInterval = std::max<std::size_t>(controlInterval, 1);
     }
     double getStabilizeTime() const
     {
-        if(newScale == scale)
+        if(rampPosition == rampTarget)
             return 0;
         if(scaleSpeed == 0)
             return INFINITY;
-        switch(scaleType)
-        {
-        case ScaleType::Linear:
-            return std::abs(newScale - scale) / scaleSpeed;
-        case ScaleType::Exponential:
-            return std::abs(std::log(newScale) - std::log(scale)) / scaleSpeed;
-        }
-        assert(false);
-        return 0;
+        return std::abs(rampTarget - rampPosition) / scaleSpeed;
     }
     void advanceTime(double deltaTime) override
     {
-        double deltaScale = newScale - scale;
-        if(deltaScale == 0 || scaleSpeed == 0)
-        {
-            source->advanceTime(deltaTime * scale);
-            return;
-        }
-        double newDeltaTime = deltaTime * scale;
-        switch(scaleType)
-        {
-        case ScaleType::Linear:
-        {
-            double stabilizeTime = std::abs(deltaScale) / scaleSpeed;
-            if(deltaTime >= stabilizeTime)
-            {
-                newDeltaTime = trapArea(stabilizeTime, scale, newScale) + rectArea(deltaTime - stabilizeTime, newScale);
-                scale = newScale;
-            }
-            else
-            {
-                double scale2 = scale + sgn(deltaScale) * scaleSpeed * deltaTime;
-                newDeltaTime = trapArea(deltaTime, scale, scale2);
-                scale = scale2;
-            }
-            break;
-        }
-        case ScaleType::Exponential:
-        {
-            deltaScale = std::log(newScale) - std::log(scale);
-            double stabilizeTime = std::abs(deltaScale) / scaleSpeed;
-            if(deltaTime >= stabilizeTime)
-            {
-                newDeltaTime = expTrapArea(stabilizeTime, scale, newScale) + rectArea(deltaTime - stabilizeTime, newScale);
-                scale = newScale;
-            }
-            else
-            {
-                double scale2 = std::exp(std::log(scale) + sgn(deltaScale) * scaleSpeed * deltaTime);
-                newDeltaTime = expTrapArea(deltaTime, scale, scale2);
-                scale = scale2;
-            }
-            break;
-        }
-        }
-        source->advanceTime(newDeltaTime);
+        source->advanceTime(advanceScale(deltaTime));
     }
     float getCurrentSample(AudioChannel channel) override
     {
         return source->getCurrentSample(channel);
     }
+    float getPeakBound() override
+    {
+        return source->getPeakBound();
+    }
+    bool render(float *output, std::size_t frameCount, double frameDuration) override
+    {
+        bool audible = false;
+        while(frameCount > 0 && ramping())
+        {
+            std::size_t blockFrameCount = std::min(frameCount, controlInterval);
+            // end the last interval with the transition so the steady scale starts on time
+            double stabilizeFrameCount = std::ceil(getStabilizeTime() / frameDuration);
+            if(stabilizeFrameCount < blockFrameCount)
+                blockFrameCount = std::max<std::size_t>((std::size_t)stabilizeFrameCount, 1);
+            double blockDuration = advanceScale(blockFrameCount * frameDuration);
+            if(source->render(output, blockFrameCount, blockDuration / blockFrameCount))
+                audible = true;
+            output += blockFrameCount * audioChannelCount;
+            frameCount -= blockFrameCount;
+        }
+        if(frameCount > 0 && source->render(output, frameCount, frameDuration * scale))
+            audible = true;
+        return audible;
+    }
     virtual std::shared_ptr<AudioSource> duplicate() const override
     {
         std::shared_ptr<TimeScaleAudioSource> retval(new TimeScaleAudioSource(source->duplicate(), scale));
-        retval->setScale(newScale, scaleSpeed);
+        retval->setScale(newScale, scaleSpeed, scaleType);
+        retval->setControlInterval(controlInterval);
         return std::move(retval);
     }
+    virtual void releaseResources() override
+    {
+        source->releaseResources();
+    }
+    virtual bool assign(const AudioSource &source) override
+    {
+        const TimeScaleAudioSource *rt = dynamic_cast<const TimeScaleAudioSource *>(&source);
+        if(!rt)
+            return false;
+        scale = rt->scale;
+        newScale = rt->newScale;
+        scaleSpeed = rt->scaleSpeed;
+        rampPosition = rt->rampPosition;
+        rampTarget = rt->rampTarget;
+        scaleType = rt->scaleType;
+        controlInterval = rt->controlInterval;
+        return this->source->assign(*rt->source);
+    }
 };
 
 class SineAudioSource : public AudioSource
@@ -166,10 +300,37 @@ public:
     {
         return amplitude * std::sin(phase);
     }
+    float getPeakBound() override
+    {
+        return std::abs(amplitude);
+    }
+    bool render(float *output, std::size_t frameCount, double frameDuration) override
+    {
+        for(std::size_t frame = 0; frame < frameCount; frame++)
+        {
+            float sample = amplitude * std::sin(phase);
+            for(std::size_t channel = 0; channel < audioChannelCount; channel++)
+            {
+                *output++ = sample;
+            }
+            SineAudioSource::advanceTime(frameDuration);
+        }
+        return amplitude != 0 && frameCount > 0;
+    }
     virtual std::shared_ptr<AudioSource> duplicate() const override
     {
         return std::shared_ptr<SineAudioSource>(new SineAudioSource(frequency, amplitude, phase));
     }
+    virtual bool assign(const AudioSource &source) override
+    {
+        const SineAudioSource *rt = dynamic_cast<const SineAudioSource *>(&source);
+        if(!rt)
+            return false;
+        frequency = rt->frequency;
+        amplitude = rt->amplitude;
+        phase = rt->phase;
+        return true;
+    }
 };
 
 class TriangleAudioSource : public AudioSource
@@ -196,10 +357,37 @@ public:
             return amplitude * (4 * cyclePosition - 4);
         return amplitude * (2 - 4 * cyclePosition);
     }
+    float getPeakBound() override
+    {
+        return std::abs(amplitude);
+    }
+    bool render(float *output, std::size_t frameCount, double frameDuration) override
+    {
+        for(std::size_t frame = 0; frame < frameCount; frame++)
+        {
+            float sample = TriangleAudioSource::getCurrentSample(AudioChannel::First);
+            for(std::size_t channel = 0; channel < audioChannelCount; channel++)
+            {
+                *output++ = sample;
+            }
+            TriangleAudioSource::advanceTime(frameDuration);
+        }
+        return amplitude != 0 && frameCount > 0;
+    }
     virtual std::shared_ptr<AudioSource> duplicate() const override
     {
         return std::shared_ptr<TriangleAudioSource>(new TriangleAudioSource(frequency, amplitude, cyclePosition * 2 * M_PI));
     }
+    virtual bool assign(const AudioSource &source) override
+    {
+        const TriangleAudioSource *rt = dynamic_cast<const TriangleAudioSource *>(&source);
+        if(!rt)
+            return false;
+        frequency = rt->frequency;
+        amplitude = rt->amplitude;
+        cyclePosition = rt->cyclePosition;
+        return true;
+    }
 };
 
 template <typename T, typename ChildClass>
@@ -207,10 +395,18 @@ class CombineAudioSource : public AudioSource
 {
 public:
     typedef T value_type;
-    typedef typename std::list<value_type>::const_iterator iterator;
+    typedef typename std::vector<value_type>::const_iterator iterator;
     typedef iterator const_iterator;
 private:
-    std::list<value_type> sources;
+    std::vector<value_type> sources;
+protected:
+    std::vector<float> renderBuffer;
+    float *getRenderBuffer(std::size_t sampleCount)
+    {
+        if(renderBuffer.size() < sampleCount)
+            renderBuffer.resize(sampleCount);
+        return &renderBuffer[0];
+    }
 public:
     template <typename ...Args>
     iterator insert(std::shared_ptr<AudioSource> source, Args ...args)
@@ -243,6 +439,12 @@ public:
             return sources.cend();
         return sources.erase(pos);
     }
+    /** @brief reserve space so inserting up to sourceCount sources doesn't allocate
+     */
+    void reserve(std::size_t sourceCount)
+    {
+        sources.reserve(sourceCount);
+    }
     iterator begin() const
     {
         return sources.cbegin();
@@ -259,6 +461,7 @@ public:
         }
     }
     float getCurrentSample(AudioChannel channel) override = 0;
+    bool render(float *output, std::size_t frameCount, double frameDuration) override = 0;
     virtual std::shared_ptr<AudioSource> duplicate() const override
     {
         auto retval = std::shared_ptr<CombineAudioSource>(new ChildClass);
@@ -270,6 +473,28 @@ public:
         }
         return std::move(retval);
     }
+    virtual void releaseResources() override
+    {
+        for(const value_type &node : sources)
+        {
+            std::get<0>(node)->releaseResources();
+        }
+    }
+    virtual bool assign(const AudioSource &source) override
+    {
+        const ChildClass *rt = dynamic_cast<const ChildClass *>(&source);
+        if(!rt || rt->sources.size() != sources.size())
+            return false;
+        for(std::size_t i = 0; i < sources.size(); i++)
+        {
+            std::shared_ptr<AudioSource> child = std::move(std::get<0>(sources[i]));
+            sources[i] = rt->sources[i];
+            std::get<0>(sources[i]) = std::move(child);
+            if(!std::get<0>(sources[i])->assign(*std::get<0>(rt->sources[i])))
+                return false;
+        }
+        return true;
+    }
 };
 
 class MixAudioSource : public CombineAudioSource<std::tuple<std::shared_ptr<AudioSource>, float>, MixAudioSource>
@@ -284,6 +509,144 @@ public:
         }
         return retval;
     }
+    float getPeakBound() override
+    {
+        float retval = 0;
+        for(const value_type &node : *this)
+        {
+            if(std::get<1>(node) != 0)
+                retval += std::abs(std::get<1>(node)) * std::get<0>(node)->getPeakBound();
+        }
+        return retval;
+    }
+    bool render(float *output, std::size_t frameCount, double frameDuration) override
+    {
+        std::size_t sampleCount = frameCount * audioChannelCount;
+        std::fill_n(output, sampleCount, 0.0f);
+        if(sampleCount == 0)
+            return false;
+        bool audible = false;
+        float *buffer = getRenderBuffer(sampleCount);
+        for(const value_type &node : *this)
+        {
+            if(!std::get<0>(node)->render(buffer, frameCount, frameDuration))
+                continue;
+            float amplitude = std::get<1>(node);
+            for(std::size_t i = 0; i < sampleCount; i++)
+            {
+                output[i] += amplitude * buffer[i];
+            }
+            audible = true;
+        }
+        return audible;
+    }
+};
+
+/** @brief a MixAudioSource that renders its sources in parallel
+ *
+ * Every source renders into its own buffer and the buffers are summed in order on the calling thread,
+ * so the output is the same as a MixAudioSource's no matter how many threads are used.
+ */
+class ParallelMixAudioSource : public CombineAudioSource<std::tuple<std::shared_ptr<AudioSource>, float>, ParallelMixAudioSource>
+{
+    std::shared_ptr<RenderThreadPool> threadPool;
+    std::size_t groupSize;
+    std::vector<float> sourceBuffers;
+    /** whether each source's buffer may be audible; char so groups on different threads don't share bits */
+    std::vector<char> sourceAudible;
+    std::size_t renderSampleCount;
+    double renderFrameDuration;
+    static void renderGroup(void *context, std::size_t groupIndex)
+    {
+        ParallelMixAudioSource &mixer = *(ParallelMixAudioSource *)context;
+        std::size_t sourceIndex = groupIndex * mixer.groupSize;
+        auto node = mixer.begin() + sourceIndex;
+        for(std::size_t i = 0; i < mixer.groupSize && node != mixer.end(); i++, sourceIndex++, node++)
+        {
+            mixer.sourceAudible[sourceIndex] = std::get<0>(*node)->render(&mixer.sourceBuffers[sourceIndex * mixer.renderSampleCount], mixer.renderSampleCount / audioChannelCount, mixer.renderFrameDuration);
+        }
+    }
+public:
+    /** @brief construct a parallel mix audio source
+     *
+     * @param threadPool the threads to render on or nullptr to render on the calling thread
+     * @param groupSize the number of sources rendered by each task
+     *
+     */
+    explicit ParallelMixAudioSource(std::shared_ptr<RenderThreadPool> threadPool = nullptr, std::size_t groupSize = 1)
+        : threadPool(std::move(threadPool)), groupSize(groupSize > 0 ? groupSize : 1), renderSampleCount(0), renderFrameDuration(0)
+    {
+    }
+    void setThreadPool(std::shared_ptr<RenderThreadPool> threadPool)
+    {
+        this->threadPool = std::move(threadPool);
+    }
+    float getCurrentSample(AudioChannel channel) override
+    {
+        float retval = 0;
+        for(const value_type &node : *this)
+        {
+            retval += std::get<1>(node) * std::get<0>(node)->getCurrentSample(channel);
+        }
+        return retval;
+    }
+    float getPeakBound() override
+    {
+        float retval = 0;
+        for(const value_type &node : *this)
+        {
+            if(std::get<1>(node) != 0)
+                retval += std::abs(std::get<1>(node)) * std::get<0>(node)->getPeakBound();
+        }
+        return retval;
+    }
+    bool render(float *output, std::size_t frameCount, double frameDuration) override
+    {
+        std::size_t sampleCount = frameCount * audioChannelCount;
+        std::fill_n(output, sampleCount, 0.0f);
+        std::size_t sourceCount = end() - begin();
+        if(sampleCount == 0 || sourceCount == 0)
+            return false;
+        if(sourceBuffers.size() < sourceCount * sampleCount)
+            sourceBuffers.resize(sourceCount * sampleCount);
+        if(sourceAudible.size() < sourceCount)
+            sourceAudible.resize(sourceCount);
+        renderSampleCount = sampleCount;
+        renderFrameDuration = frameDuration;
+        std::size_t groupCount = (sourceCount + groupSize - 1) / groupSize;
+        if(threadPool)
+            threadPool->run(groupCount, renderGroup, this);
+        else
+        {
+            for(std::size_t i = 0; i < groupCount; i++)
+                renderGroup(this, i);
+        }
+        bool audible = false;
+        const float *buffer = &sourceBuffers[0];
+        std::size_t sourceIndex = 0;
+        for(const value_type &node : *this)
+        {
+            if(sourceAudible[sourceIndex++])
+            {
+                float amplitude = std::get<1>(node);
+                for(std::size_t i = 0; i < sampleCount; i++)
+                {
+                    output[i] += amplitude * buffer[i];
+                }
+                audible = true;
+            }
+            buffer += sampleCount;
+        }
+        return audible;
+    }
+    virtual std::shared_ptr<AudioSource> duplicate() const override
+    {
+        std::shared_ptr<AudioSource> retval = CombineAudioSource::duplicate();
+        ParallelMixAudioSource &mixer = static_cast<ParallelMixAudioSource &>(*retval);
+        mixer.threadPool = threadPool;
+        mixer.groupSize = groupSize;
+        return retval;
+    }
 };
 
 class ModulateAudioSource : public CombineAudioSource<std::tuple<std::shared_ptr<AudioSource>>, ModulateAudioSource>
@@ -298,6 +661,42 @@ public:
         }
         return retval;
     }
+    float getPeakBound() override
+    {
+        float retval = 1;
+        for(const value_type &node : *this)
+        {
+            float peakBound = std::get<0>(node)->getPeakBound();
+            if(peakBound == 0)
+                return 0;
+            retval *= peakBound;
+        }
+        return retval;
+    }
+    bool render(float *output, std::size_t frameCount, double frameDuration) override
+    {
+        std::size_t sampleCount = frameCount * audioChannelCount;
+        std::fill_n(output, sampleCount, 1.0f);
+        if(sampleCount == 0)
+            return false;
+        bool audible = true;
+        float *buffer = getRenderBuffer(sampleCount);
+        for(const value_type &node : *this)
+        {
+            // every source still renders to keep time, but one silent source silences the product
+            if(!std::get<0>(node)->render(buffer, frameCount, frameDuration))
+                audible = false;
+            if(!audible)
+                continue;
+            for(std::size_t i = 0; i < sampleCount; i++)
+            {
+                output[i] *= buffer[i];
+            }
+        }
+        if(!audible)
+            std::fill_n(output, sampleCount, 0.0f);
+        return audible;
+    }
 };
 
 class AmplifyAudioSource : public AudioSource
@@ -308,10 +707,14 @@ public:
         Exponential,
         Linear,
     };
+    static constexpr std::size_t defaultControlInterval = TimeScaleAudioSource::defaultControlInterval;
 private:
     double amplitude, newAmplitude, amplitudeSpeed;
+    /** the amplitude and the target amplitude along the ramp: the amplitude itself or its modified log */
+    double rampPosition, rampTarget;
     ScaleType scaleType;
     std::shared_ptr<AudioSource> source;
+    std::size_t controlInterval;
     static constexpr double logTransitionPoint = 1e-5;
     static double modifiedLog(double v)
     {
@@ -331,9 +734,40 @@ private:
         else
             return std::exp(v);
     }
+    double toRamp(double v) const
+    {
+        if(scaleType == ScaleType::Exponential)
+            return modifiedLog(v);
+        return v;
+    }
+    double fromRamp(double v) const
+    {
+        if(scaleType == ScaleType::Exponential)
+            return modifiedExp(v);
+        return v;
+    }
+    bool ramping() const
+    {
+        return rampPosition != rampTarget && amplitudeSpeed != 0;
+    }
+    void advanceAmplitude(double deltaTime)
+    {
+        if(!ramping())
+            return;
+        if(deltaTime >= getStabilizeTime())
+        {
+            rampPosition = rampTarget;
+            amplitude = newAmplitude;
+        }
+        else
+        {
+            rampPosition += sgn(rampTarget - rampPosition) * amplitudeSpeed * deltaTime;
+            amplitude = fromRamp(rampPosition);
+        }
+    }
 public:
     AmplifyAudioSource(std::shared_ptr<AudioSource> source, double amplitude = 1.0)
-        : amplitude(amplitude), newAmplitude(amplitude), amplitudeSpeed(1), scaleType(ScaleType::Linear), source(std::move(source))
+        : amplitude(amplitude), newAmplitude(amplitude), amplitudeSpeed(1), rampPosition(amplitude), rampTarget(amplitude), scaleType(ScaleType::Linear), source(std::move(source)), controlInterval(defaultControlInterval)
     {
     }
     void setAmplitude(double newAmplitude, double amplitudeSpeed, ScaleType scaleType)
@@ -341,70 +775,133 @@ public:
         this->newAmplitude = newAmplitude;
         this->amplitudeSpeed = amplitudeSpeed;
         this->scaleType = scaleType;
+        // the logs are taken once here instead of on every step of the transition
+        rampPosition = toRamp(amplitude);
+        rampTarget = toRamp(newAmplitude);
+    }
+    double getAmplitude() const
+    {
+        return amplitude;
+    }
+    /** @brief set the amplitude without a transition
+     */
+    void resetAmplitude(double amplitude)
+    {
+        this->amplitude = amplitude;
+        newAmplitude = amplitude;
+        amplitudeSpeed = 1;
+        scaleType = ScaleType::Linear;
+        rampPosition = amplitude;
+        rampTarget = amplitude;
+    }
+    std::size_t getControlInterval() const
+    {
+        return controlInterval;
+    }
+    /** @brief set how often render updates the amplitude during a transition
+     *
+     * The amplitude is computed every controlInterval frames and linearly interpolated in between.
+     *
+     * @param controlInterval the frames between updates; 1 updates every frame
+     *
+     */
+    void setControlInterval(std::size_t controlInterval)
+    {
+        this->controlInterval = std::max<std::size_t>(controlInterval, 1);
     }
     double getStabilizeTime() const
     {
-        if(newAmplitude == amplitude)
+        if(rampPosition == rampTarget)
             return 0;
         if(amplitudeSpeed == 0)
             return INFINITY;
-        switch(scaleType)
-        {
-        case ScaleType::Linear:
-            return std::abs(newAmplitude - amplitude) / amplitudeSpeed;
-        case ScaleType::Exponential:
-            return std::abs(modifiedLog(newAmplitude) - modifiedLog(amplitude)) / amplitudeSpeed;
-        }
-        assert(false);
-        return 0;
+        return std::abs(rampTarget - rampPosition) / amplitudeSpeed;
     }
     void advanceTime(double deltaTime) override
     {
         source->advanceTime(deltaTime);
-        double deltaAmplitude = newAmplitude - amplitude;
-        if(deltaAmplitude == 0 || amplitudeSpeed == 0)
-            return;
-        switch(scaleType)
+        advanceAmplitude(deltaTime);
+    }
+    float getCurrentSample(AudioChannel channel) override
+    {
+        return amplitude * source->getCurrentSample(channel);
+    }
+    float getPeakBound() override
+    {
+        // the amplitude only moves toward newAmplitude
+        float gain = std::max(std::abs(amplitude), std::abs(newAmplitude));
+        if(gain == 0)
+            return 0;
+        return gain * source->getPeakBound();
+    }
+    bool render(float *output, std::size_t frameCount, double frameDuration) override
+    {
+        if(amplitude == 0 && (newAmplitude == 0 || amplitudeSpeed == 0))
         {
-        case ScaleType::Linear:
+            // a muted source only has to keep time
+            std::fill_n(output, frameCount * audioChannelCount, 0.0f);
+            source->advanceTime(frameCount * frameDuration);
+            return false;
+        }
+        if(!source->render(output, frameCount, frameDuration))
         {
-            double stabilizeTime = std::abs(deltaAmplitude) / amplitudeSpeed;
-            if(deltaTime >= stabilizeTime)
-            {
-                amplitude = newAmplitude;
-            }
-            else
-            {
-                amplitude += sgn(deltaAmplitude) * amplitudeSpeed * deltaTime;
-            }
-            break;
+            advanceAmplitude(frameCount * frameDuration);
+            return false;
         }
-        case ScaleType::Exponential:
+        // while the amplitude is changing the gain is ramped linearly between control points
+        while(frameCount > 0 && ramping())
         {
-            deltaAmplitude = modifiedLog(newAmplitude) - modifiedLog(amplitude);
-            double stabilizeTime = std::abs(deltaAmplitude) / amplitudeSpeed;
-            if(deltaTime >= stabilizeTime)
-            {
-                amplitude = newAmplitude;
-            }
-            else
+            std::size_t blockFrameCount = std::min(frameCount, controlInterval);
+            // end the last interval with the transition so the steady gain starts on time
+            double stabilizeFrameCount = std::ceil(getStabilizeTime() / frameDuration);
+            if(stabilizeFrameCount < blockFrameCount)
+                blockFrameCount = std::max<std::size_t>((std::size_t)stabilizeFrameCount, 1);
+            float gain = amplitude;
+            advanceAmplitude(blockFrameCount * frameDuration);
+            float gainStep = ((float)amplitude - gain) / blockFrameCount;
+            for(std::size_t frame = 0; frame < blockFrameCount; frame++, gain += gainStep)
             {
-                amplitude = modifiedExp(modifiedLog(amplitude) + sgn(deltaAmplitude) * amplitudeSpeed * deltaTime);
+                for(std::size_t channel = 0; channel < audioChannelCount; channel++)
+                {
+                    *output++ *= gain;
+                }
             }
-            break;
+            frameCount -= blockFrameCount;
         }
+        if(amplitude == 1)
+            return true;
+        float gain = amplitude;
+        for(std::size_t i = 0, sampleCount = frameCount * audioChannelCount; i < sampleCount; i++)
+        {
+            output[i] *= gain;
         }
-    }
-    float getCurrentSample(AudioChannel channel) override
-    {
-        return amplitude * source->getCurrentSample(channel);
+        return true;
     }
     virtual std::shared_ptr<AudioSource> duplicate() const override
     {
         auto retval = std::make_shared<AmplifyAudioSource>(source->duplicate(), amplitude);
         retval->setAmplitude(newAmplitude, amplitudeSpeed, scaleType);
+        retval->setControlInterval(controlInterval);
         return std::move(retval);
     }
+    virtual void releaseResources() override
+    {
+        source->releaseResources();
+    }
+    virtual bool assign(const AudioSource &source) override
+    {
+        const AmplifyAudioSource *rt = dynamic_cast<const AmplifyAudioSource *>(&source);
+        if(!rt)
+            return false;
+        amplitude = rt->amplitude;
+        newAmplitude = rt->newAmplitude;
+        amplitudeSpeed = rt->amplitudeSpeed;
+        rampPosition = rt->rampPosition;
+        rampTarget = rt->rampTarget;
+        scaleType = rt->scaleType;
+        controlInterval = rt->controlInterval;
+        return this->source->assign(*rt->source);
+    }
 };
 
 class PanAudioSource : public AudioSource
@@ -428,10 +925,78 @@ public:
             return source->getCurrentSample(channel);
         return channelAmplitudes[c] * source->getCurrentSample(channel);
     }
+    float getPeakBound() override
+    {
+        float gain = 0;
+        for(float amplitude : channelAmplitudes)
+            gain = std::max(gain, std::abs(amplitude));
+        if(gain == 0)
+            return 0;
+        return gain * source->getPeakBound();
+    }
+    bool render(float *output, std::size_t frameCount, double frameDuration) override
+    {
+        if(!source->render(output, frameCount, frameDuration))
+            return false;
+        for(std::size_t frame = 0; frame < frameCount; frame++)
+        {
+            for(float amplitude : channelAmplitudes)
+            {
+                *output++ *= amplitude;
+            }
+        }
+        return true;
+    }
     virtual std::shared_ptr<AudioSource> duplicate() const override
     {
         return std::make_shared<PanAudioSource>(source->duplicate(), channelAmplitudes);
     }
+    virtual void releaseResources() override
+    {
+        source->releaseResources();
+    }
+    virtual bool assign(const AudioSource &source) override
+    {
+        const PanAudioSource *rt = dynamic_cast<const PanAudioSource *>(&source);
+        if(!rt)
+            return false;
+        channelAmplitudes = rt->channelAmplitudes;
+        return this->source->assign(*rt->source);
+    }
+};
+
+/** @brief applies commands posted from other threads to the audio graph
+ */
+class CommandSource
+{
+public:
+    CommandSource() = default;
+    CommandSource(const CommandSource &) = delete;
+    const CommandSource &operator =(const CommandSource &) = delete;
+    virtual ~CommandSource() = default;
+    /** @brief apply the commands that are due
+     *
+     * Called on the audio thread, so it must not block or allocate.
+     *
+     * @param currentTime the current time; commands at or before it are due
+     *
+     */
+    virtual void dispatchCommands(double currentTime) = 0;
+    /** @brief get the time of the next pending command
+     *
+     * @return the time of the next command or INFINITY if there are no timed commands pending
+     *
+     */
+    virtual double getNextCommandTime()
+    {
+        return INFINITY;
+    }
+    /** @brief get the number of commands waiting to be dispatched, for statistics
+     */
+    virtual std::size_t getPendingCommandCount()
+    {
+        return 0;
+    }
 };
 
 class EventDispatcherAudioSource : public AudioSource
@@ -473,8 +1038,43 @@ private:
         }
     };
     std::priority_queue<EventStruct> eventQueue;
+    std::vector<std::shared_ptr<CommandSource>> commandSources;
     double currentTime;
     std::shared_ptr<AudioSource> source;
+    std::shared_ptr<RenderStatistics> statistics;
+    void dispatchCommands()
+    {
+        for(const std::shared_ptr<CommandSource> &commandSource : commandSources)
+        {
+            commandSource->dispatchCommands(currentTime);
+        }
+    }
+    /** @brief run the events and commands due at or before the current frame
+     */
+    void dispatchDue(double frameDuration)
+    {
+        // events that land within rounding error of a frame belong to it
+        double dueTime = currentTime + frameDuration * 1e-6;
+        while(!eventQueue.empty() && eventQueue.top().triggerTime <= dueTime)
+        {
+            EventStruct event = eventQueue.top();
+            eventQueue.pop();
+            event.event();
+        }
+        for(const std::shared_ptr<CommandSource> &commandSource : commandSources)
+        {
+            commandSource->dispatchCommands(dueTime);
+        }
+    }
+    double getNextEventTime()
+    {
+        double retval = eventQueue.empty() ? INFINITY : eventQueue.top().triggerTime;
+        for(const std::shared_ptr<CommandSource> &commandSource : commandSources)
+        {
+            retval = std::min(retval, commandSource->getNextCommandTime());
+        }
+        return retval;
+    }
 public:
     EventDispatcherAudioSource(std::shared_ptr<AudioSource> source = nullptr)
         : currentTime(0), source(source)
@@ -485,8 +1085,37 @@ public:
         assert(deltaTime >= 0);
         eventQueue.push(EventStruct(deltaTime + currentTime, event));
     }
+    /** @brief add a source of commands to apply at their times
+     *
+     * Unlike scheduleEvent, commands can be posted from other threads without locking the audio output.
+     * Add command sources before rendering starts.
+     *
+     * @param commandSource the command source
+     *
+     */
+    void addCommandSource(std::shared_ptr<CommandSource> commandSource)
+    {
+        if(commandSource != nullptr)
+            commandSources.push_back(std::move(commandSource));
+    }
+    /** @brief report the event queue depth after every block
+     *
+     * @param statistics the statistics to update or nullptr to stop updating
+     *
+     */
+    void setStatistics(std::shared_ptr<RenderStatistics> statistics)
+    {
+        this->statistics = std::move(statistics);
+    }
+    /** @brief check if any scheduled events or commands are left to apply
+     */
+    bool hasPendingEvents()
+    {
+        return getNextEventTime() != INFINITY;
+    }
     void advanceTime(double deltaTime) override
     {
+        dispatchCommands();
         double finalTime = currentTime + deltaTime;
         while(!eventQueue.empty() && eventQueue.top().triggerTime <= finalTime)
         {
@@ -507,6 +1136,40 @@ public:
             return source->getCurrentSample(channel);
         return 0;
     }
+    /** @brief render a block of audio
+     *
+     * Events and commands are applied at the start of the first frame at or after their time,
+     * rendering the frames between them as sub-blocks.
+     */
+    bool render(float *output, std::size_t frameCount, double frameDuration) override
+    {
+        bool audible = false;
+        while(frameCount > 0)
+        {
+            dispatchDue(frameDuration);
+            std::size_t blockFrameCount = frameCount;
+            double frameDelay = (getNextEventTime() - currentTime) / frameDuration;
+            if(frameDelay < frameCount)
+                blockFrameCount = frameDelay <= 1 ? 1 : (std::size_t)std::ceil(frameDelay - 1e-6);
+            if(source && source->render(output, blockFrameCount, frameDuration))
+                audible = true;
+            else if(!source)
+                std::fill_n(output, blockFrameCount * audioChannelCount, 0.0f);
+            currentTime += blockFrameCount * frameDuration;
+            output += blockFrameCount * audioChannelCount;
+            frameCount -= blockFrameCount;
+        }
+        if(statistics)
+        {
+            std::size_t depth = eventQueue.size();
+            for(const std::shared_ptr<CommandSource> &commandSource : commandSources)
+            {
+                depth += commandSource->getPendingCommandCount();
+            }
+            statistics->setEventQueueDepth(depth);
+        }
+        return audible;
+    }
     virtual std::shared_ptr<AudioSource> duplicate() const override
     {
         throw std::runtime_error("non duplicable");
@@ -516,22 +1179,183 @@ public:
 class SampledAudioSource : public AudioSource
 {
     std::shared_ptr<AudioData> data;
-    double currentSample;
+    /** the read position; kept in fixed point so long notes don't drift */
+    SamplePhase currentSample;
     float amplitude;
-    SampledAudioSource(std::shared_ptr<AudioData> data, double currentSample, float amplitude)
-        : data(std::move(data)), currentSample(currentSample), amplitude(amplitude)
+    std::size_t loopCount;
+    InterpolationMode interpolationMode;
+    DiskStreamer::Voice *streamVoice;
+    SampledAudioSource(std::shared_ptr<AudioData> data, SamplePhase currentSample, float amplitude, std::size_t loopCount, InterpolationMode interpolationMode)
+        : data(std::move(data)), currentSample(currentSample), amplitude(amplitude), loopCount(loopCount), interpolationMode(interpolationMode), streamVoice(nullptr)
+    {
+    }
+    void advancePosition(SamplePhase deltaSample)
+    {
+        SamplePhase endPhase = getFramePhase(data->frameCount);
+        currentSample += deltaSample;
+        while(data->looped && currentSample >= endPhase && amplitude > 1e-10)
+        {
+            currentSample -= getFramePhase(data->frameCount - data->loopStart);
+            amplitude *= data->loopDecayAmplitude;
+            loopCount++;
+        }
+        // nothing is read past the end anymore; stopping there keeps the phase from overflowing
+        if(currentSample > endPhase && (!data->looped || amplitude <= 1e-10))
+            currentSample = endPhase;
+    }
+    /** @brief get the stream index of a frame in the current repetition of the loop
+     *
+     * @param levelData the data or the mip level the frame index is in
+     *
+     */
+    std::uint64_t getStreamIndex(const AudioData &levelData, std::size_t frameIndex) const
+    {
+        if(loopCount == 0)
+            return frameIndex;
+        std::uint64_t loopFrameCount = levelData.frameCount - levelData.loopStart;
+        return levelData.frameCount + (loopCount - 1) * loopFrameCount + (frameIndex - levelData.loopStart);
+    }
+    const AudioData &getMipLevel(unsigned level) const
+    {
+        return level == 0 ? *data : *data->mipLevels[level - 1];
+    }
+    /** @brief pick the mip level that keeps the step between 0.75 and 1.5 frames of the level where it can
+     */
+    unsigned selectMipLevel(SamplePhase step) const
+    {
+        unsigned level = 0;
+        while(level < data->mipLevels.size() && step >= (3 * samplePhaseOne / 2) << level)
+            level++;
+        return level;
+    }
+    void readStreamedFrame(std::uint64_t streamIndex, float *frame)
+    {
+        if(streamIndex < data->residentFrameCount)
+        {
+            for(std::size_t channel = 0; channel < audioChannelCount; channel++)
+                frame[channel] = data->getSample(channel, streamIndex);
+        }
+        else if(streamVoice)
+            streamVoice->readFrame(streamIndex, frame);
+        else
+            std::fill_n(frame, audioChannelCount, 0.0f);
+    }
+    /** @brief read a frame at a stream index, scaled by the loop decay of its repetition
+     *
+     * Frames before the start, or after the end of data that doesn't loop, are silent.
+     */
+    void readTapFrame(const AudioData &levelData, std::int64_t streamIndex, float *frame)
+    {
+        std::fill_n(frame, audioChannelCount, 0.0f);
+        if(streamIndex < 0)
+            return;
+        std::uint64_t frameIndex = streamIndex;
+        std::size_t repetition = 0;
+        if(frameIndex >= levelData.frameCount)
+        {
+            std::uint64_t loopFrameCount = levelData.frameCount - levelData.loopStart;
+            if(!levelData.looped || loopFrameCount == 0)
+                return;
+            repetition = 1 + (frameIndex - levelData.frameCount) / loopFrameCount;
+            frameIndex = levelData.loopStart + (frameIndex - levelData.frameCount) % loopFrameCount;
+        }
+        float gain = amplitude;
+        for(std::size_t i = loopCount; i < repetition && gain >= 1e-10; i++)
+            gain *= data->loopDecayAmplitude;
+        for(std::size_t i = repetition; i < loopCount; i++)
+            gain /= data->loopDecayAmplitude;
+        if(gain < 1e-10)
+            return;
+        if(levelData.stream)
+            readStreamedFrame(streamIndex, frame);
+        else
+        {
+            for(std::size_t channel = 0; channel < audioChannelCount; channel++)
+                frame[channel] = levelData.getSample(channel, frameIndex);
+        }
+        for(std::size_t channel = 0; channel < audioChannelCount; channel++)
+            frame[channel] *= gain;
+    }
+    /** @brief interpolate the current frame one tap at a time
+     *
+     * Used where the taps wrap around the loop, fall before the start or aren't resident.
+     */
+    void renderEdgeFrame(float *output, unsigned level, InterpolationMode mode)
     {
+        const AudioData &levelData = getMipLevel(level);
+        SamplePhase position = currentSample >> level;
+        float weights[maxInterpolationTapCount];
+        std::size_t tapCount = getInterpolationTapCount(mode);
+        getInterpolationWeights(mode, getSampleFraction(position), weights);
+        std::int64_t streamIndex = (std::int64_t)getStreamIndex(levelData, getSampleIndex(position)) - (std::int64_t)getInterpolationLeadingTapCount(mode);
+        std::fill_n(output, audioChannelCount, 0.0f);
+        for(std::size_t tap = 0; tap < tapCount; tap++)
+        {
+            float frame[audioChannelCount];
+            readTapFrame(levelData, streamIndex + tap, frame);
+            for(std::size_t channel = 0; channel < audioChannelCount; channel++)
+                output[channel] += weights[tap] * frame[channel];
+        }
+    }
+    /** @brief let the streamer reuse the frames before the first tap of the current frame
+     */
+    void updateStreamReadPosition(InterpolationMode mode)
+    {
+        // the leading taps are behind the position and have to stay in the ring
+        std::uint64_t streamIndex = getStreamIndex(*data, getSampleIndex(currentSample));
+        std::size_t leadingTapCount = getInterpolationLeadingTapCount(mode);
+        streamVoice->setReadPosition(streamIndex > leadingTapCount ? streamIndex - leadingTapCount : 0);
+    }
+    void releaseStreamVoice()
+    {
+        if(streamVoice)
+            data->stream->streamer->releaseVoice(streamVoice);
+        streamVoice = nullptr;
+    }
+    /** @brief count the frames that can be interpolated straight from memory
+     *
+     * Stops before the taps reach past the end of the data and returns 0 while they reach before its start.
+     * The count is in the phases of the mip level, currentSample >> level advanced by step >> level.
+     */
+    std::size_t getInterpolatableFrameCount(unsigned level, std::size_t frameCount, SamplePhase step, InterpolationMode mode) const
+    {
+        const AudioData &levelData = getMipLevel(level);
+        SamplePhase position = currentSample >> level;
+        step >>= level;
+        std::size_t leadingTapCount = getInterpolationLeadingTapCount(mode);
+        std::size_t trailingTapCount = getInterpolationTapCount(mode) - leadingTapCount - 1;
+        // past the end non-looped data reads the zero padding but looped data has to wrap
+        std::size_t endFrameCount = levelData.looped ? levelData.frameCount : levelData.frameCount + trailingTapCount;
+        // streamed data only has the head in memory
+        if(levelData.stream)
+            endFrameCount = loopCount == 0 ? levelData.residentFrameCount : 0;
+        SamplePhase limit = endFrameCount > trailingTapCount ? getFramePhase(endFrameCount - trailingTapCount) : 0;
+        // after the first repetition the frames before the loop start weren't the ones played
+        SamplePhase start = getFramePhase(leadingTapCount + (loopCount > 0 ? levelData.loopStart : 0));
+        if(position >= limit || position < start)
+            return 0;
+        if(step == 0)
+            return frameCount;
+        // the phases are exact, so this is exactly the frames before the limit
+        SamplePhase maxFrameCount = (limit - position - 1) / step + 1;
+        return maxFrameCount < frameCount ? (std::size_t)maxFrameCount : frameCount;
     }
 public:
-    SampledAudioSource(std::shared_ptr<AudioData> data)
-        : data(std::move(data)), currentSample(0), amplitude(1)
+    SampledAudioSource(std::shared_ptr<AudioData> data, InterpolationMode interpolationMode = InterpolationMode::Default)
+        : data(std::move(data)), currentSample(0), amplitude(1), loopCount(0), interpolationMode(interpolationMode), streamVoice(nullptr)
     {
     }
+    SampledAudioSource(const SampledAudioSource &) = delete;
+    const SampledAudioSource &operator =(const SampledAudioSource &) = delete;
+    ~SampledAudioSource()
+    {
+        releaseStreamVoice();
+    }
     bool finished() const
     {
         if(!data)
             return true;
-        if(!data->looped && currentSample >= data->data.size())
+        if(!data->looped && currentSample >= getFramePhase(data->frameCount))
             return true;
         return false;
     }
@@ -539,12 +1363,35 @@ public:
     {
         if(!data)
             return;
-        currentSample += deltaTime * data->sampleRate;
-        while(data->looped && currentSample >= data->data.size() && amplitude > 1e-10)
-        {
-            currentSample = currentSample + data->loopStart - data->data.size();
-            amplitude *= data->loopDecayAmplitude;
-        }
+        advancePosition(toSamplePhase(deltaTime * data->sampleRate));
+        // a muted voice is advanced without rendering; keep the streamer reading ahead of it
+        if(streamVoice)
+            updateStreamReadPosition(resolveInterpolationMode(interpolationMode));
+    }
+    InterpolationMode getInterpolationMode() const
+    {
+        return interpolationMode;
+    }
+    /** @brief set how the samples are resampled
+     *
+     * @param interpolationMode the interpolation mode or InterpolationMode::Default to follow the process wide default
+     *
+     */
+    void setInterpolationMode(InterpolationMode interpolationMode)
+    {
+        this->interpolationMode = interpolationMode;
+    }
+    float getPeakBound() override
+    {
+        if(finished() || amplitude <= 1e-10)
+            return 0;
+        if(data->looped && data->loopDecayAmplitude > 1)
+            return INFINITY;
+        float peak = data->peak;
+        for(const std::shared_ptr<AudioData> &mipLevel : data->mipLevels)
+            peak = std::max(peak, mipLevel->peak);
+        // filters with negative weights can overshoot the samples they read
+        return amplitude * peak * getInterpolationGain(interpolationMode);
     }
     float getCurrentSample(AudioChannel channel) override
     {
@@ -554,48 +1401,75 @@ public:
             return 0;
         if(amplitude <= 1e-10)
             return 0;
-        double floorCurrentSample = std::floor(currentSample);
-        float t = currentSample - floorCurrentSample;
-        std::size_t currentSampleIndex = (std::size_t)floorCurrentSample;
-        std::size_t nextSampleIndex = currentSampleIndex + 1;
-        float sample1 = amplitude, sample2 = amplitude;
-        if(data->looped)
-        {
-            while(currentSampleIndex >= data->data.size())
+        float frame[audioChannelCount];
+        renderEdgeFrame(frame, 0, resolveInterpolationMode(interpolationMode));
+        return frame[(std::size_t)channel];
+    }
+    bool render(float *output, std::size_t frameCount, double frameDuration) override
+    {
+        if(!data)
+        {
+            std::fill_n(output, frameCount * audioChannelCount, 0.0f);
+            return false;
+        }
+        bool audible = false;
+        // the step is rounded once per block so every frame advances by the same exact amount
+        SamplePhase step = toSamplePhase(frameDuration * data->sampleRate);
+        InterpolationMode mode = resolveInterpolationMode(interpolationMode);
+        // far above the original pitch a band limited level reads fewer frames and doesn't alias
+        unsigned level = selectMipLevel(step);
+        if(data->stream && !streamVoice && !finished() && amplitude > 1e-10)
+            streamVoice = data->stream->streamer->acquireVoice(*data);
+        while(frameCount > 0)
+        {
+            if(finished() || amplitude <= 1e-10)
             {
-                sample1 *= data->loopDecayAmplitude;
-                if(sample1 < 1e-10)
-                {
-                    sample1 = 0;
-                    break;
-                }
-                currentSampleIndex = currentSampleIndex + data->loopStart - data->data.size();
+                std::fill_n(output, frameCount * audioChannelCount, 0.0f);
+                advancePosition(frameCount * step);
+                releaseStreamVoice();
+                return audible;
             }
-            if(sample1 != 0)
-                sample1 *= data->data[currentSampleIndex][(size_t)channel];
-            while(nextSampleIndex >= data->data.size())
+            audible = true;
+            std::size_t blockFrameCount = getInterpolatableFrameCount(level, frameCount, step, mode);
+            if(blockFrameCount > 0)
             {
-                sample2 *= data->loopDecayAmplitude;
-                if(sample2 < 1e-10)
-                {
-                    sample2 = 0;
-                    break;
-                }
-                nextSampleIndex = nextSampleIndex + data->loopStart - data->data.size();
+                interpolateSamples(output, blockFrameCount, getMipLevel(level), currentSample >> level, step >> level, amplitude, mode);
+                advancePosition(blockFrameCount * step);
+            }
+            else
+            {
+                // the frames around the start, the loop and the end of the data, and streamed frames
+                blockFrameCount = 1;
+                renderEdgeFrame(output, level, mode);
+                advancePosition(step);
             }
-            if(sample2 != 0)
-                sample2 *= data->data[nextSampleIndex][(size_t)channel];
-            return t * sample1 + (1 - t) * sample2;
+            output += blockFrameCount * audioChannelCount;
+            frameCount -= blockFrameCount;
         }
-        if(currentSampleIndex < data->data.size())
-            sample1 = data->data[currentSampleIndex][(size_t)channel];
-        if(nextSampleIndex < data->data.size())
-            sample2 = data->data[nextSampleIndex][(size_t)channel];
-        return t * sample1 + (1 - t) * sample2;
+        if(streamVoice)
+            updateStreamReadPosition(mode);
+        return audible;
     }
     virtual std::shared_ptr<AudioSource> duplicate() const override
     {
-        return std::shared_ptr<AudioSource>(new SampledAudioSource(data, currentSample, amplitude));
+        return std::shared_ptr<AudioSource>(new SampledAudioSource(data, currentSample, amplitude, loopCount, interpolationMode));
+    }
+    virtual void releaseResources() override
+    {
+        releaseStreamVoice();
+    }
+    virtual bool assign(const AudioSource &source) override
+    {
+        const SampledAudioSource *rt = dynamic_cast<const SampledAudioSource *>(&source);
+        if(!rt)
+            return false;
+        releaseStreamVoice();
+        data = rt->data;
+        currentSample = rt->currentSample;
+        amplitude = rt->amplitude;
+        loopCount = rt->loopCount;
+        interpolationMode = rt->interpolationMode;
+        return true;
     }
 };
 
@@ -609,10 +1483,23 @@ public:
     {
         return 0;
     }
+    float getPeakBound() override
+    {
+        return 0;
+    }
+    bool render(float *output, std::size_t frameCount, double frameDuration) override
+    {
+        std::fill_n(output, frameCount * audioChannelCount, 0.0f);
+        return false;
+    }
     virtual std::shared_ptr<AudioSource> duplicate() const override
     {
         return std::shared_ptr<AudioSource>(new SilenceAudioSource);
     }
+    virtual bool assign(const AudioSource &source) override
+    {
+        return dynamic_cast<const SilenceAudioSource *>(&source) != nullptr;
+    }
 };
 
 #endif // AUDIO_SOURCE_H_INCLUDED
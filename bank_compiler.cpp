@@ -0,0 +1,35 @@
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <cstdlib>
+#include "sample_bank.h"
+
+using namespace std;
+
+int main(int argc, char **argv)
+{
+    unsigned threadCount = 0;
+    int argIndex = 1;
+    if(argc == 5 && string(argv[1]) == "-j")
+    {
+        threadCount = strtoul(argv[2], nullptr, 10);
+        argIndex = 3;
+    }
+    if(argc - argIndex != 2)
+    {
+        cerr << "usage: " << argv[0] << " [-j <threads>] <instrument directory> <output bank>" << endl;
+        return 1;
+    }
+    try
+    {
+        SampledInstrumentDescription description = parseInstrumentDirectory(argv[argIndex]);
+        loadInstrumentAudio(description, threadCount);
+        writeBank(argv[argIndex + 1], description);
+    }
+    catch(exception &e)
+    {
+        cerr << "error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,448 @@
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <random>
+#include <vector>
+#include <sys/stat.h>
+#include "midi_channel.h"
+#include "sample_bank.h"
+#include "disk_streamer.h"
+
+using namespace std;
+
+namespace
+{
+struct Options
+{
+    double duration = 2;
+    size_t blockFrameCount = 256;
+    unsigned sampleRate = 44100;
+    double deadline = 0;
+    size_t maxVoiceCount = 4096;
+    AudioData::SampleFormat sampleFormat = AudioData::SampleFormat::Float32;
+    InterpolationMode interpolationMode = InterpolationMode::Linear;
+    size_t mipLevelCount = 0;
+    /** streams long samples of a bank when not nullptr */
+    shared_ptr<DiskStreamer> streamer;
+    size_t residentFrameCount = defaultStreamResidentFrameCount;
+};
+
+const size_t voiceCounts[] = {1, 16, 64, 256};
+
+typedef chrono::steady_clock Clock;
+
+double getSeconds(Clock::duration duration)
+{
+    return chrono::duration<double>(duration).count();
+}
+
+string quote(const string &str)
+{
+    string retval = "\"";
+    for(char ch : str)
+    {
+        if(ch == '"' || ch == '\\')
+            retval += '\\';
+        retval += ch;
+    }
+    return retval + "\"";
+}
+
+struct Timing
+{
+    size_t frameCount;
+    double seconds;
+    /** the 99th percentile of the time taken by a block */
+    double slowBlockSeconds;
+    /** the average of the voices counted after every block or 0 if they weren't counted */
+    double averageVoiceCount;
+};
+
+/** @brief render a source for the benchmark duration, timing every block
+ *
+ * @param source the source to render
+ * @param options the benchmark options
+ * @param duration the length of audio to render in seconds
+ * @param getVoiceCount called after every block to count the playing voices or nullptr
+ * @return the timing
+ *
+ */
+Timing timeRender(AudioSource &source, const Options &options, double duration, function<size_t()> getVoiceCount = nullptr)
+{
+    vector<float> buffer(options.blockFrameCount * audioChannelCount);
+    size_t blockCount = max<size_t>(1, (size_t)(duration * options.sampleRate / options.blockFrameCount));
+    vector<double> blockSeconds;
+    blockSeconds.reserve(blockCount);
+    double frameDuration = 1.0 / options.sampleRate;
+    double voiceCountSum = 0;
+    for(size_t i = 0; i < blockCount; i++)
+    {
+        Clock::time_point startTime = Clock::now();
+        source.render(&buffer[0], options.blockFrameCount, frameDuration);
+        blockSeconds.push_back(getSeconds(Clock::now() - startTime));
+        if(getVoiceCount)
+            voiceCountSum += getVoiceCount();
+    }
+    Timing retval;
+    retval.frameCount = blockCount * options.blockFrameCount;
+    retval.seconds = 0;
+    for(double seconds : blockSeconds)
+        retval.seconds += seconds;
+    size_t slowIndex = blockCount * 99 / 100;
+    nth_element(blockSeconds.begin(), blockSeconds.begin() + slowIndex, blockSeconds.end());
+    retval.slowBlockSeconds = blockSeconds[slowIndex];
+    retval.averageVoiceCount = voiceCountSum / blockCount;
+    return retval;
+}
+
+/** @brief print a benchmark run
+ *
+ * The cost per voice is divided by the voices counted while rendering if there are any,
+ * otherwise by the voices started.
+ */
+void printTiming(const string &benchmark, size_t voiceCount, const Timing &timing, const Options &options)
+{
+    double audioSeconds = (double)timing.frameCount / options.sampleRate;
+    double averageVoiceCount = timing.averageVoiceCount > 0 ? timing.averageVoiceCount : (double)voiceCount;
+    cout << "{\"benchmark\":" << quote(benchmark)
+         << ",\"voices\":" << voiceCount;
+    if(timing.averageVoiceCount > 0)
+        cout << ",\"average_voices\":" << timing.averageVoiceCount;
+    cout << ",\"ns_per_frame_per_voice\":" << timing.seconds * 1e9 / timing.frameCount / max(averageVoiceCount, 1.0)
+         << ",\"p99_block_ms\":" << timing.slowBlockSeconds * 1e3
+         << ",\"realtime_factor\":" << audioSeconds / timing.seconds
+         << "}" << endl;
+}
+
+/** @brief load every audio file of an instrument without building the instrument
+ */
+SampledInstrumentDescription loadDescription(const string &path, const Options &options)
+{
+    struct stat st;
+    SampledInstrumentDescription retval;
+    if(stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+    {
+        retval = readBank(path, options.streamer, options.residentFrameCount);
+        for(SampledInstrumentDescription::Key &key : retval.keys)
+        {
+            for(SampledInstrumentDescription::AudioFile &audioFile : key.audioFiles)
+            {
+                audioFile.audioData->buildMipLevels(options.mipLevelCount);
+                audioFile.audioData->convert(options.sampleFormat);
+            }
+        }
+        return retval;
+    }
+    retval = parseInstrumentDirectory(path);
+    loadInstrumentAudio(retval, 0, options.sampleFormat, options.mipLevelCount);
+    return retval;
+}
+
+int getBenchmarkKey(size_t voiceIndex)
+{
+    // spread the voices over the 88 piano keys
+    return 21 + (int)(voiceIndex * 37 % 88);
+}
+
+shared_ptr<AudioSource> makeOscillators(size_t voiceCount, bool triangle)
+{
+    auto mixer = make_shared<MixAudioSource>();
+    for(size_t i = 0; i < voiceCount; i++)
+    {
+        double frequency = getKeyFrequency(getBenchmarkKey(i));
+        if(triangle)
+            mixer->insert(make_shared<TriangleAudioSource>(frequency, 0.1f), 1.0f);
+        else
+            mixer->insert(make_shared<SineAudioSource>(frequency, 0.1f), 1.0f);
+    }
+    return mixer;
+}
+
+/** @brief make sampled sources played at a multiple of their recorded speed
+ */
+shared_ptr<AudioSource> makeSampledSources(size_t voiceCount, const vector<shared_ptr<AudioData>> &audioData, double speed = 1)
+{
+    auto mixer = make_shared<MixAudioSource>();
+    for(size_t i = 0; i < voiceCount; i++)
+    {
+        shared_ptr<AudioSource> source = make_shared<SampledAudioSource>(audioData[i % audioData.size()]);
+        if(speed != 1)
+            source = make_shared<TimeScaleAudioSource>(source, speed);
+        mixer->insert(source, 0.1f);
+    }
+    return mixer;
+}
+
+/** @brief time voiceCount keys played without a channel
+ *
+ * The keys are retired afterwards, as a channel would, so the instrument can reuse them.
+ */
+Timing timeKeys(size_t voiceCount, const shared_ptr<MidiInstrument> &instrument, const Options &options, double duration)
+{
+    MixAudioSource mixer;
+    vector<shared_ptr<MidiKey>> keys;
+    for(size_t i = 0; i < voiceCount; i++)
+    {
+        shared_ptr<MidiKey> key = instrument->generate(getBenchmarkKey(i), defaultVelocity, 0);
+        if(key == nullptr)
+            throw runtime_error("too few voices for the key benchmark");
+        mixer.insert(key, 0.1f);
+        keys.push_back(std::move(key));
+    }
+    Timing retval = timeRender(mixer, options, duration);
+    for(const shared_ptr<MidiKey> &key : keys)
+        key->retire();
+    return retval;
+}
+
+shared_ptr<MidiChannel> makeChannel(size_t voiceCount, const shared_ptr<MidiInstrument> &instrument)
+{
+    auto channel = make_shared<MidiChannel>(instrument);
+    for(size_t i = 0; i < voiceCount; i++)
+    {
+        // once every key is playing, a repeated key releases the earlier note, which dies out
+        channel->noteOn(getBenchmarkKey(i), defaultVelocity);
+    }
+    return channel;
+}
+
+/** @brief time a midi channel playing voiceCount notes, counting the voices still sounding after every block
+ */
+Timing timeChannel(size_t voiceCount, const shared_ptr<MidiInstrument> &instrument, const Options &options, double duration)
+{
+    auto channel = makeChannel(voiceCount, instrument);
+    return timeRender(*channel, options, duration, [&]()
+    {
+        return channel->getSoundingKeyCount();
+    });
+}
+
+/** @brief plays chords of random keys at a steady rate, each held for the same time
+ */
+class NoteWorkload : public CommandSource
+{
+    struct NoteOff
+    {
+        double time;
+        int midiKey;
+    };
+    shared_ptr<MidiChannel> channel;
+    double chordInterval;
+    size_t chordSize;
+    double holdTime;
+    double nextChordTime;
+    deque<NoteOff> noteOffs;
+    minstd_rand random;
+public:
+    NoteWorkload(shared_ptr<MidiChannel> channel, double chordRate, size_t chordSize, double holdTime)
+        : channel(std::move(channel)), chordInterval(1 / chordRate), chordSize(min<size_t>(chordSize, 88)), holdTime(holdTime), nextChordTime(0)
+    {
+    }
+    virtual void dispatchCommands(double currentTime) override
+    {
+        while(!noteOffs.empty() && noteOffs.front().time <= currentTime)
+        {
+            channel->noteOff(noteOffs.front().midiKey);
+            noteOffs.pop_front();
+        }
+        while(nextChordTime <= currentTime)
+        {
+            int firstKey = 21 + (int)(random() % (89 - chordSize));
+            for(size_t i = 0; i < chordSize; i++)
+            {
+                int midiKey = firstKey + (int)i;
+                channel->noteOn(midiKey, 40 + (int)(random() % 80));
+                noteOffs.push_back(NoteOff{nextChordTime + holdTime, midiKey});
+            }
+            nextChordTime += chordInterval;
+        }
+    }
+    virtual double getNextCommandTime() override
+    {
+        if(noteOffs.empty())
+            return nextChordTime;
+        return min(nextChordTime, noteOffs.front().time);
+    }
+};
+
+void runWorkload(const string &benchmark, double chordRate, size_t chordSize, const shared_ptr<MidiInstrument> &instrument, const Options &options)
+{
+    auto channel = make_shared<MidiChannel>(instrument);
+    auto eventDispatcher = make_shared<EventDispatcherAudioSource>(channel);
+    eventDispatcher->addCommandSource(make_shared<NoteWorkload>(channel, chordRate, chordSize, 0.5));
+    Timing timing = timeRender(*eventDispatcher, options, options.duration, [&]()
+    {
+        return channel->getSoundingKeyCount();
+    });
+    cout << "{\"benchmark\":" << quote(benchmark)
+         << ",\"chords_per_second\":" << chordRate
+         << ",\"chord_size\":" << chordSize
+         << ",\"average_voices\":" << timing.averageVoiceCount
+         << ",\"ns_per_frame\":" << timing.seconds * 1e9 / timing.frameCount
+         << ",\"ns_per_frame_per_voice\":" << timing.seconds * 1e9 / timing.frameCount / max(timing.averageVoiceCount, 1.0)
+         << ",\"p99_block_ms\":" << timing.slowBlockSeconds * 1e3
+         << "}" << endl;
+}
+
+/** @brief time voiceCount notes spread over as many midi channels as it takes to play every note on its own key
+ */
+Timing timeChannels(size_t voiceCount, const shared_ptr<MidiInstrument> &instrument, const Options &options, double duration)
+{
+    auto mixer = make_shared<MixAudioSource>();
+    vector<shared_ptr<MidiChannel>> channels;
+    for(size_t first = 0; first < voiceCount; first += 88)
+    {
+        channels.push_back(makeChannel(min<size_t>(voiceCount - first, 88), instrument));
+        mixer->insert(channels.back(), 0.1f);
+    }
+    return timeRender(*mixer, options, duration, [&]()
+    {
+        size_t retval = 0;
+        for(const shared_ptr<MidiChannel> &channel : channels)
+            retval += channel->getSoundingKeyCount();
+        return retval;
+    });
+}
+
+/** @brief find the most voices midi channels can play while their slow blocks still meet the deadline
+ *
+ * The voices reported are the average actually sounding, which falls short of the notes started once samples end.
+ */
+void findMaxVoices(const shared_ptr<MidiInstrument> &instrument, const Options &options)
+{
+    double trialDuration = min(options.duration, 1.0);
+    double lowAverageVoiceCount = 0;
+    auto meetsDeadline = [&](size_t voiceCount)
+    {
+        Timing timing = timeChannels(voiceCount, instrument, options, trialDuration);
+        if(timing.slowBlockSeconds > options.deadline)
+            return false;
+        lowAverageVoiceCount = timing.averageVoiceCount;
+        return true;
+    };
+    size_t low = 0, high = 1;
+    while(high <= options.maxVoiceCount && meetsDeadline(high))
+    {
+        low = high;
+        high *= 2;
+    }
+    high = min(high, options.maxVoiceCount + 1);
+    // low meets the deadline and high doesn't
+    while(high - low > 1)
+    {
+        size_t middle = low + (high - low) / 2;
+        if(meetsDeadline(middle))
+            low = middle;
+        else
+            high = middle;
+    }
+    cout << "{\"benchmark\":\"max_voices\""
+         << ",\"block_frames\":" << options.blockFrameCount
+         << ",\"deadline_ms\":" << options.deadline * 1e3
+         << ",\"notes\":" << low
+         << ",\"voices\":" << lowAverageVoiceCount
+         << "}" << endl;
+}
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    vector<string> paths;
+    for(int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if(arg == "-t" && i + 1 < argc)
+            options.duration = strtod(argv[++i], nullptr);
+        else if(arg == "-b" && i + 1 < argc)
+            options.blockFrameCount = strtoul(argv[++i], nullptr, 10);
+        else if(arg == "-d" && i + 1 < argc)
+            options.deadline = strtod(argv[++i], nullptr) * 1e-3;
+        else if(arg == "-f" && i + 1 < argc && (string(argv[i + 1]) == "16" || string(argv[i + 1]) == "24" || string(argv[i + 1]) == "float"))
+        {
+            string format = argv[++i];
+            options.sampleFormat = format == "16" ? AudioData::SampleFormat::Int16 : format == "24" ? AudioData::SampleFormat::Int24 : AudioData::SampleFormat::Float32;
+        }
+        else if(arg == "-i" && i + 1 < argc)
+        {
+            try
+            {
+                options.interpolationMode = parseInterpolationMode(argv[++i]);
+            }
+            catch(exception &e)
+            {
+                cerr << "error: " << e.what() << endl;
+                return 1;
+            }
+        }
+        else if(arg == "-m" && i + 1 < argc)
+            options.mipLevelCount = strtoul(argv[++i], nullptr, 10);
+        else if(arg == "-s" && i + 1 < argc)
+            options.streamer = make_shared<DiskStreamer>(strtoul(argv[++i], nullptr, 10));
+        else if(arg == "-r" && i + 1 < argc)
+            options.residentFrameCount = strtoul(argv[++i], nullptr, 10);
+        else if(arg.size() > 1 && arg[0] == '-')
+        {
+            cerr << "usage: " << argv[0] << " [-t <seconds per run>] [-b <block frames>] [-d <deadline ms>] [-f 16|24|float] [-i none|linear|cubic|sinc] [-m <mip levels>] [-s <streamed voices>] [-r <resident frames>] [<bank or instrument directory>...]" << endl;
+            return 1;
+        }
+        else
+            paths.push_back(arg);
+    }
+    if(paths.empty())
+        paths.push_back("samples/p200 piano");
+    if(options.duration <= 0 || options.blockFrameCount == 0)
+    {
+        cerr << "error: invalid duration or block size" << endl;
+        return 1;
+    }
+    if(options.deadline <= 0)
+        options.deadline = (double)options.blockFrameCount / options.sampleRate;
+    setDefaultInterpolationMode(options.interpolationMode);
+    try
+    {
+        for(const string &path : paths)
+        {
+            Clock::time_point startTime = Clock::now();
+            loadInstrument(path, 0, options.sampleFormat, InterpolationMode::Default, options.mipLevelCount, options.streamer, options.residentFrameCount);
+            cout << "{\"benchmark\":\"load\",\"path\":" << quote(path) << ",\"seconds\":" << getSeconds(Clock::now() - startTime) << "}" << endl;
+        }
+        SampledInstrumentDescription description = loadDescription(paths[0], options);
+        // every key range needs a voice for each note findMaxVoices might play, as they're never allocated while playing
+        shared_ptr<MidiInstrument> instrument = makeSampledInstrument(description, InterpolationMode::Default, options.maxVoiceCount);
+        vector<shared_ptr<AudioData>> audioData;
+        for(const SampledInstrumentDescription::Key &key : description.keys)
+        {
+            for(const SampledInstrumentDescription::AudioFile &audioFile : key.audioFiles)
+                audioData.push_back(audioFile.audioData);
+        }
+        if(audioData.empty())
+            throw runtime_error("no audio in instrument : " + paths[0]);
+        for(size_t voiceCount : voiceCounts)
+        {
+            printTiming("sine", voiceCount, timeRender(*makeOscillators(voiceCount, false), options, options.duration), options);
+            printTiming("triangle", voiceCount, timeRender(*makeOscillators(voiceCount, true), options, options.duration), options);
+            printTiming("sampled", voiceCount, timeRender(*makeSampledSources(voiceCount, audioData), options, options.duration), options);
+            // two octaves up, where mip levels read a quarter of the frames
+            printTiming("sampled_transposed", voiceCount, timeRender(*makeSampledSources(voiceCount, audioData, 4), options, options.duration), options);
+            printTiming("key", voiceCount, timeKeys(voiceCount, instrument, options, options.duration), options);
+            printTiming("channel", voiceCount, timeChannel(voiceCount, instrument, options, options.duration), options);
+        }
+        for(double chordRate : {1.0, 10.0, 50.0, 200.0})
+            runWorkload("note_rate", chordRate, 1, instrument, options);
+        for(size_t chordSize : {1, 4, 16, 64})
+            runWorkload("chord_density", 4, chordSize, instrument, options);
+        findMaxVoices(instrument, options);
+    }
+    catch(exception &e)
+    {
+        cerr << "error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
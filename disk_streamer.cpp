@@ -0,0 +1,157 @@
+#include "disk_streamer.h"
+#include <chrono>
+#include <stdexcept>
+#include <cerrno>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+constexpr size_t maxFillFrameCount = 1 << 14;
+}
+
+bool AudioDataStream::read(std::size_t channel, std::size_t frameIndex, std::size_t frameCount, float *output) const
+{
+    char *buffer = (char *)output;
+    size_t length = frameCount * sizeof(float);
+    off_t offset = dataOffset + (channel * channelStride + frameIndex) * sizeof(float);
+    while(length > 0)
+    {
+        ssize_t readCount = pread(*fileDescriptor, buffer, length, offset);
+        if(readCount < 0 && errno == EINTR)
+            continue;
+        if(readCount <= 0)
+            return false;
+        buffer += readCount;
+        length -= readCount;
+        offset += readCount;
+    }
+    return true;
+}
+
+std::shared_ptr<int> openStreamFile(const std::string &fileName)
+{
+    int fd = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        throw runtime_error("can't open file : " + fileName);
+    return shared_ptr<int>(new int(fd), [](int *fd)
+    {
+        close(*fd);
+        delete fd;
+    });
+}
+
+DiskStreamer::DiskStreamer(std::size_t maxVoiceCount, std::size_t ringFrameCount)
+    : ringFrameCount(1), underrunCount(0), done(false)
+{
+    while(this->ringFrameCount < ringFrameCount)
+        this->ringFrameCount <<= 1;
+    for(size_t i = 0; i < maxVoiceCount; i++)
+        voices.push_back(unique_ptr<Voice>(new Voice(this->ringFrameCount, &underrunCount)));
+    thread = std::thread([this]()
+    {
+        run();
+    });
+}
+
+DiskStreamer::~DiskStreamer()
+{
+    done = true;
+    thread.join();
+}
+
+DiskStreamer::Voice *DiskStreamer::acquireVoice(const AudioData &data)
+{
+    for(unique_ptr<Voice> &voice : voices)
+    {
+        int state = Voice::Free;
+        if(!voice->state.compare_exchange_strong(state, Voice::Claimed, memory_order_acquire))
+            continue;
+        voice->stream = data.stream;
+        voice->frameCount = data.frameCount;
+        voice->loopStart = data.loopStart;
+        voice->looped = data.looped;
+        voice->readPosition.store(data.residentFrameCount, memory_order_relaxed);
+        voice->writePosition.store(data.residentFrameCount, memory_order_relaxed);
+        voice->state.store(Voice::Active, memory_order_release);
+        return voice.get();
+    }
+    return nullptr;
+}
+
+void DiskStreamer::releaseVoice(Voice *voice)
+{
+    if(voice)
+        voice->state.store(Voice::Releasing, memory_order_release);
+}
+
+bool DiskStreamer::fill(Voice &voice)
+{
+    uint64_t readPosition = voice.readPosition.load(memory_order_acquire);
+    uint64_t writePosition = voice.writePosition.load(memory_order_relaxed);
+    // after an underrun the reader is ahead; frames it skipped are never read
+    if(writePosition < readPosition)
+        writePosition = readPosition;
+    uint64_t endPosition = readPosition + ringFrameCount;
+    bool streamEnds = !voice.looped && endPosition >= voice.frameCount;
+    if(streamEnds)
+        endPosition = voice.frameCount;
+    if(writePosition >= endPosition)
+        return false;
+    size_t fillFrameCount = min<uint64_t>(endPosition - writePosition, maxFillFrameCount);
+    // wait for a larger read unless the voice is running low
+    if(fillFrameCount < maxFillFrameCount / 4 && !streamEnds && writePosition - readPosition > ringFrameCount / 2)
+        return false;
+    readBuffer.resize(maxFillFrameCount);
+    size_t loopFrameCount = voice.frameCount - voice.loopStart;
+    for(uint64_t position = writePosition; position < writePosition + fillFrameCount;)
+    {
+        // split the fill where the stream wraps around the loop or the ring
+        size_t fileIndex = position;
+        if(position >= voice.frameCount)
+            fileIndex = voice.loopStart + (position - voice.frameCount) % loopFrameCount;
+        size_t ringIndex = position & voice.ringFrameMask;
+        size_t frameCount = writePosition + fillFrameCount - position;
+        frameCount = min(frameCount, voice.frameCount - fileIndex);
+        frameCount = min(frameCount, ringFrameCount - ringIndex);
+        for(size_t channel = 0; channel < audioChannelCount; channel++)
+        {
+            if(!voice.stream->read(channel, fileIndex, frameCount, &readBuffer[0]))
+                fill_n(readBuffer.begin(), frameCount, 0.0f);
+            for(size_t i = 0; i < frameCount; i++)
+                voice.ring[(ringIndex + i) * audioChannelCount + channel] = readBuffer[i];
+        }
+        position += frameCount;
+    }
+    voice.writePosition.store(writePosition + fillFrameCount, memory_order_release);
+    return true;
+}
+
+void DiskStreamer::run()
+{
+    while(!done)
+    {
+        bool didWork = false;
+        for(unique_ptr<Voice> &voice : voices)
+        {
+            switch(voice->state.load(memory_order_acquire))
+            {
+            case Voice::Active:
+                if(fill(*voice))
+                    didWork = true;
+                break;
+            case Voice::Releasing:
+                voice->stream = nullptr;
+                voice->state.store(Voice::Free, memory_order_release);
+                break;
+            default:
+                break;
+            }
+        }
+        if(!didWork)
+            this_thread::sleep_for(chrono::milliseconds(2));
+    }
+}
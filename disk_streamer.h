@@ -0,0 +1,145 @@
+#ifndef DISK_STREAMER_H_INCLUDED
+#define DISK_STREAMER_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <string>
+#include "audio_data.h"
+
+class DiskStreamer;
+
+/** @brief the location of the frames of an AudioData that aren't resident
+ *
+ * Channel c, frame i is stored as a float at dataOffset + (c * channelStride + i) * sizeof(float) in the file.
+ */
+struct AudioDataStream
+{
+    std::shared_ptr<int> fileDescriptor;
+    std::uint64_t dataOffset;
+    std::size_t channelStride;
+    std::shared_ptr<DiskStreamer> streamer;
+    AudioDataStream(std::shared_ptr<int> fileDescriptor, std::uint64_t dataOffset, std::size_t channelStride, std::shared_ptr<DiskStreamer> streamer)
+        : fileDescriptor(std::move(fileDescriptor)), dataOffset(dataOffset), channelStride(channelStride), streamer(std::move(streamer))
+    {
+    }
+    /** @brief read frames of one channel from the file
+     *
+     * @return true if all the frames were read
+     */
+    bool read(std::size_t channel, std::size_t frameIndex, std::size_t frameCount, float *output) const;
+};
+
+/** @brief opens a file for use by AudioDataStream
+ *
+ * @param fileName the file to open
+ * @return the shared file descriptor, closed when the last reference goes away
+ *
+ */
+std::shared_ptr<int> openStreamFile(const std::string &fileName);
+
+/** @brief reads streamed AudioData ahead of the playing voices
+ *
+ * A background thread fills a ring buffer per playing voice from disk.
+ * Voices read frames in play order by stream index: the frame index that keeps counting
+ * up through every repetition of the loop instead of wrapping back to AudioData::loopStart.
+ * Nothing the audio thread calls blocks or allocates.
+ */
+class DiskStreamer
+{
+public:
+    class Voice
+    {
+        friend class DiskStreamer;
+        enum State
+        {
+            Free,
+            Claimed,
+            Active,
+            Releasing,
+        };
+        std::atomic_int state;
+        std::shared_ptr<AudioDataStream> stream;
+        std::size_t frameCount;
+        std::size_t loopStart;
+        bool looped;
+        std::vector<float> ring;
+        std::size_t ringFrameMask;
+        std::atomic<std::uint64_t> readPosition;
+        std::atomic<std::uint64_t> writePosition;
+        std::atomic<std::size_t> *underrunCount;
+        Voice(std::size_t ringFrameCount, std::atomic<std::size_t> *underrunCount)
+            : state(Free), frameCount(0), loopStart(0), looped(false), ring(ringFrameCount * audioChannelCount), ringFrameMask(ringFrameCount - 1), readPosition(0), writePosition(0), underrunCount(underrunCount)
+        {
+        }
+    public:
+        /** @brief read a frame that the background thread has streamed in
+         *
+         * @param streamIndex the stream index of the frame, at least the last read position
+         * @param frame where to write audioChannelCount samples
+         * @return false if the frame isn't streamed in yet; the frame is then silent
+         *
+         */
+        bool readFrame(std::uint64_t streamIndex, float *frame)
+        {
+            if(streamIndex < writePosition.load(std::memory_order_acquire))
+            {
+                std::size_t ringIndex = (streamIndex & ringFrameMask) * audioChannelCount;
+                for(std::size_t channel = 0; channel < audioChannelCount; channel++)
+                    frame[channel] = ring[ringIndex + channel];
+                return true;
+            }
+            for(std::size_t channel = 0; channel < audioChannelCount; channel++)
+                frame[channel] = 0;
+            underrunCount->fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        /** @brief tell the background thread which frames are no longer needed
+         *
+         * @param streamIndex the lowest stream index that will be read from now on
+         *
+         */
+        void setReadPosition(std::uint64_t streamIndex)
+        {
+            readPosition.store(streamIndex, std::memory_order_release);
+        }
+    };
+private:
+    std::vector<std::unique_ptr<Voice>> voices;
+    std::size_t ringFrameCount;
+    std::atomic<std::size_t> underrunCount;
+    std::atomic_bool done;
+    std::vector<float> readBuffer;
+    std::thread thread;
+    void run();
+    bool fill(Voice &voice);
+public:
+    /** @brief construct a disk streamer and start its background thread
+     *
+     * @param maxVoiceCount the maximum number of voices that can stream at once
+     * @param ringFrameCount the number of frames buffered ahead for each voice, rounded up to a power of 2
+     *
+     */
+    explicit DiskStreamer(std::size_t maxVoiceCount = 64, std::size_t ringFrameCount = 1 << 16);
+    DiskStreamer(const DiskStreamer &) = delete;
+    const DiskStreamer &operator =(const DiskStreamer &) = delete;
+    ~DiskStreamer();
+    /** @brief start streaming an AudioData
+     *
+     * Streaming starts at stream index data.residentFrameCount.
+     *
+     * @param data the streamed AudioData
+     * @return the voice to read from or nullptr if every voice is in use
+     *
+     */
+    Voice *acquireVoice(const AudioData &data);
+    void releaseVoice(Voice *voice);
+    std::size_t getUnderrunCount() const
+    {
+        return underrunCount.load(std::memory_order_relaxed);
+    }
+};
+
+#endif // DISK_STREAMER_H_INCLUDED
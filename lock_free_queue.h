@@ -0,0 +1,257 @@
+#ifndef LOCK_FREE_QUEUE_H_INCLUDED
+#define LOCK_FREE_QUEUE_H_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/** @brief a bounded wait-free queue for one producer thread and one consumer thread
+ */
+template <typename T>
+class SpscQueue
+{
+    std::vector<T> buffer;
+    std::size_t mask;
+    alignas(64) std::atomic<std::size_t> head;
+    alignas(64) std::atomic<std::size_t> tail;
+public:
+    /** @brief construct a queue
+     *
+     * @param capacity the maximum number of queued values, rounded up to a power of 2
+     *
+     */
+    explicit SpscQueue(std::size_t capacity)
+        : head(0), tail(0)
+    {
+        std::size_t size = 1;
+        while(size < capacity)
+            size <<= 1;
+        buffer.resize(size);
+        mask = size - 1;
+    }
+    SpscQueue(const SpscQueue &) = delete;
+    const SpscQueue &operator =(const SpscQueue &) = delete;
+    /** @brief add a value to the queue; only call from the producer thread
+     *
+     * @return false if the queue is full
+     */
+    bool push(const T &value)
+    {
+        std::size_t position = tail.load(std::memory_order_relaxed);
+        if(position - head.load(std::memory_order_acquire) > mask)
+            return false;
+        buffer[position & mask] = value;
+        tail.store(position + 1, std::memory_order_release);
+        return true;
+    }
+    /** @brief count the queued values; only call from the consumer thread
+     */
+    std::size_t size() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_relaxed);
+    }
+    /** @brief look at the next value without removing it; only call from the consumer thread
+     *
+     * @return the next value or nullptr if the queue is empty
+     */
+    const T *front() const
+    {
+        std::size_t position = head.load(std::memory_order_relaxed);
+        if(position == tail.load(std::memory_order_acquire))
+            return nullptr;
+        return &buffer[position & mask];
+    }
+    /** @brief remove a value from the queue; only call from the consumer thread
+     *
+     * @return false if the queue is empty
+     */
+    bool pop(T &value)
+    {
+        std::size_t position = head.load(std::memory_order_relaxed);
+        if(position == tail.load(std::memory_order_acquire))
+            return false;
+        value = buffer[position & mask];
+        head.store(position + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+/** @brief a bounded wait-free ring of values written and read in runs, for one producer thread and one consumer thread
+ *
+ * The positions only change once per run, so unlike the queues they aren't padded apart.
+ */
+template <typename T>
+class SpscRingBuffer
+{
+    std::vector<T> buffer;
+    std::size_t mask;
+    std::atomic<std::size_t> head;
+    std::atomic<std::size_t> tail;
+public:
+    /** @brief construct a ring buffer
+     *
+     * @param capacity the maximum number of buffered values, rounded up to a power of 2
+     *
+     */
+    explicit SpscRingBuffer(std::size_t capacity)
+        : head(0), tail(0)
+    {
+        std::size_t size = 1;
+        while(size < capacity)
+            size <<= 1;
+        buffer.resize(size);
+        mask = size - 1;
+    }
+    SpscRingBuffer(const SpscRingBuffer &) = delete;
+    const SpscRingBuffer &operator =(const SpscRingBuffer &) = delete;
+    std::size_t capacity() const
+    {
+        return mask + 1;
+    }
+    /** @brief count the values that can be written; only call from the producer thread
+     */
+    std::size_t getWritableCount() const
+    {
+        return mask + 1 - (tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire));
+    }
+    /** @brief count the values that can be read; only call from the consumer thread
+     */
+    std::size_t getReadableCount() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_relaxed);
+    }
+    /** @brief add values to the ring; only call from the producer thread
+     *
+     * @return the number of values written, less than count if the ring fills up
+     */
+    std::size_t write(const T *values, std::size_t count)
+    {
+        std::size_t position = tail.load(std::memory_order_relaxed);
+        count = std::min(count, mask + 1 - (position - head.load(std::memory_order_acquire)));
+        std::size_t start = position & mask;
+        std::size_t firstCount = std::min(count, mask + 1 - start);
+        std::copy(values, values + firstCount, &buffer[start]);
+        std::copy(values + firstCount, values + count, &buffer[0]);
+        tail.store(position + count, std::memory_order_release);
+        return count;
+    }
+    /** @brief remove values from the ring; only call from the consumer thread
+     *
+     * @return the number of values read, less than count if the ring runs out
+     */
+    std::size_t read(T *values, std::size_t count)
+    {
+        std::size_t position = head.load(std::memory_order_relaxed);
+        count = std::min(count, tail.load(std::memory_order_acquire) - position);
+        std::size_t start = position & mask;
+        std::size_t firstCount = std::min(count, mask + 1 - start);
+        std::copy(&buffer[start], &buffer[start] + firstCount, values);
+        std::copy(&buffer[0], &buffer[0] + (count - firstCount), values + firstCount);
+        head.store(position + count, std::memory_order_release);
+        return count;
+    }
+};
+
+/** @brief a bounded lock-free queue for any number of producer threads and one consumer thread
+ *
+ * Every slot has a sequence number saying whether it is free for the producer
+ * claiming that position or holds a value for the consumer.
+ * The consumer never waits on producers; producers only retry when they race each other for a slot.
+ */
+template <typename T>
+class MpscQueue
+{
+    struct Cell
+    {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+    std::unique_ptr<Cell[]> cells;
+    std::size_t mask;
+    alignas(64) std::atomic<std::size_t> tail;
+    alignas(64) std::size_t head;
+public:
+    /** @brief construct a queue
+     *
+     * @param capacity the maximum number of queued values, rounded up to a power of 2
+     *
+     */
+    explicit MpscQueue(std::size_t capacity)
+        : tail(0), head(0)
+    {
+        std::size_t size = 1;
+        while(size < capacity)
+            size <<= 1;
+        cells.reset(new Cell[size]);
+        for(std::size_t i = 0; i < size; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        mask = size - 1;
+    }
+    MpscQueue(const MpscQueue &) = delete;
+    const MpscQueue &operator =(const MpscQueue &) = delete;
+    /** @brief add a value to the queue
+     *
+     * @return false if the queue is full
+     */
+    bool push(const T &value)
+    {
+        std::size_t position = tail.load(std::memory_order_relaxed);
+        Cell *cell;
+        while(true)
+        {
+            cell = &cells[position & mask];
+            std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t difference = (std::ptrdiff_t)sequence - (std::ptrdiff_t)position;
+            if(difference == 0)
+            {
+                if(tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(difference < 0)
+                return false;
+            else
+                position = tail.load(std::memory_order_relaxed);
+        }
+        cell->value = value;
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+    /** @brief count the queued values; only call from the consumer thread
+     *
+     * Values that producers are still writing are counted.
+     */
+    std::size_t size() const
+    {
+        return tail.load(std::memory_order_relaxed) - head;
+    }
+    /** @brief look at the next value without removing it; only call from the consumer thread
+     *
+     * @return the next value or nullptr if the queue is empty
+     */
+    const T *front() const
+    {
+        const Cell &cell = cells[head & mask];
+        if(cell.sequence.load(std::memory_order_acquire) != head + 1)
+            return nullptr;
+        return &cell.value;
+    }
+    /** @brief remove a value from the queue; only call from the consumer thread
+     *
+     * @return false if the queue is empty
+     */
+    bool pop(T &value)
+    {
+        Cell &cell = cells[head & mask];
+        if(cell.sequence.load(std::memory_order_acquire) != head + 1)
+            return false;
+        value = cell.value;
+        cell.sequence.store(head + mask + 1, std::memory_order_release);
+        head++;
+        return true;
+    }
+};
+
+#endif // LOCK_FREE_QUEUE_H_INCLUDED
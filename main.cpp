@@ -2,18 +2,20 @@
 #include <thread>
 #include <mutex>
 #include <chrono>
+#include <cstdlib>
 #include "audio_output.h"
 #include "midi_channel.h"
 #include "audio_data.h"
+#include "sample_bank.h"
+#include "disk_streamer.h"
+#include "audio_data_cache.h"
+#include "midi_file.h"
+#include "wav_audio_output.h"
 
 using namespace std;
 
-int main()
+void scheduleMelody(shared_ptr<EventDispatcherAudioSource> eventDispatcher, shared_ptr<MidiChannel> channel)
 {
-    auto instrument = loadFromDirectory("samples/p200 piano");
-    auto channel = make_shared<MidiChannel>(instrument);
-    auto finalMixer = make_shared<MixAudioSource>();
-    auto eventDispatcher = make_shared<EventDispatcherAudioSource>(finalMixer);
     double t = 0;
 
     eventDispatcher->scheduleEvent(t += 0.0, [=](){channel->noteOn(60, defaultVelocity);});
@@ -109,9 +111,83 @@ int main()
     eventDispatcher->scheduleEvent(t += 0.25, [=](){channel->noteOff(60, defaultVelocity);});
     eventDispatcher->scheduleEvent(t += 0.0, [=](){channel->noteOn(67, defaultVelocity);});
     eventDispatcher->scheduleEvent(t += 0.5, [=](){channel->noteOff(67, defaultVelocity);});
+}
 
-    finalMixer->insert(channel, 0.3);
-    auto audioOutput = makeDeviceAudioOutput();
+int main(int argc, char **argv)
+{
+    // the interpolation quality can be traded for CPU per deployment
+    if(getenv("MIDI_SYNTH_INTERPOLATION"))
+        setDefaultInterpolationMode(parseInterpolationMode(getenv("MIDI_SYNTH_INTERPOLATION")));
+    // decoded audio that no instrument uses any more is kept for later loads up to this many megabytes, or all of it for 0
+    if(getenv("MIDI_SYNTH_SAMPLE_CACHE_MB"))
+        AudioDataCache::getDefault().setMemoryBudget((size_t)strtoul(getenv("MIDI_SYNTH_SAMPLE_CACHE_MB"), nullptr, 10) << 20);
+    // stream long samples of a compiled bank from disk for banks too big to keep in memory;
+    // MIDI_SYNTH_STREAM_VOICES is how many voices can stream at once
+    shared_ptr<DiskStreamer> streamer;
+    if(getenv("MIDI_SYNTH_STREAM_VOICES"))
+        streamer = make_shared<DiskStreamer>(strtoul(getenv("MIDI_SYNTH_STREAM_VOICES"), nullptr, 10));
+    size_t residentFrameCount = getenv("MIDI_SYNTH_STREAM_RESIDENT_FRAMES") ? strtoul(getenv("MIDI_SYNTH_STREAM_RESIDENT_FRAMES"), nullptr, 10) : defaultStreamResidentFrameCount;
+    // the instrument can be a compiled sample bank or an instrument directory
+    auto instrument = loadInstrument(argc > 1 ? argv[1] : "samples/p200 piano", 0, AudioData::SampleFormat::Float32, InterpolationMode::Default, 0, streamer, residentFrameCount);
+    auto threadPool = make_shared<RenderThreadPool>();
+    auto finalMixer = make_shared<ParallelMixAudioSource>(threadPool);
+    auto eventDispatcher = make_shared<EventDispatcherAudioSource>(finalMixer);
+    auto statistics = make_shared<RenderStatistics>();
+    eventDispatcher->setStatistics(statistics);
+    // export statistics for Prometheus when asked to
+    unique_ptr<StatisticsExporter> statisticsExporter;
+    if(getenv("MIDI_SYNTH_METRICS_FILE"))
+        statisticsExporter.reset(new StatisticsExporter(statistics, getenv("MIDI_SYNTH_METRICS_FILE")));
+    else if(getenv("MIDI_SYNTH_METRICS_SOCKET"))
+        statisticsExporter.reset(new StatisticsExporter(statistics, getenv("MIDI_SYNTH_METRICS_SOCKET"), StatisticsExporter::Target::Socket));
+    if(argc > 2)
+    {
+        // play a midi file with the instrument on every program
+        auto instrumentProvider = make_shared<GenericMidiInstrumentProvider>();
+        for(int program = 0; program < 128; program++)
+            instrumentProvider->insert(program, instrument);
+        auto channelBank = make_shared<MidiChannelBank>(instrumentProvider, nullptr, threadPool);
+        channelBank->setStatistics(statistics);
+        eventDispatcher->addCommandSource(make_shared<MidiFilePlayer>(make_shared<MidiFile>(argv[2]), channelBank));
+        finalMixer->insert(channelBank, 0.3);
+    }
+    else
+    {
+        auto channel = make_shared<MidiChannel>(instrument);
+        channel->setStatistics(statistics, 0);
+        scheduleMelody(eventDispatcher, channel);
+        finalMixer->insert(channel, 0.3);
+    }
+    // MIDI_SYNTH_DITHER=1 dithers 16 bit output, to the device or a wav file
+    bool dither = getenv("MIDI_SYNTH_DITHER") && string(getenv("MIDI_SYNTH_DITHER")) != "0";
+    if(argc > 3)
+    {
+        // bounce to a wav file: 16, 24 or float samples
+        string format = argc > 4 ? argv[4] : "16";
+        WavAudioOutput::SampleFormat sampleFormat = format == "24" ? WavAudioOutput::SampleFormat::Int24
+            : format == "float" ? WavAudioOutput::SampleFormat::Float32
+            : WavAudioOutput::SampleFormat::Int16;
+        WavAudioOutput audioOutput(argv[3], sampleFormat);
+        audioOutput.setDither(dither);
+        audioOutput.bind(eventDispatcher);
+        WavAudioOutput::Statistics statistics = audioOutput.render(INFINITY, [=]()
+        {
+            return !eventDispatcher->hasPendingEvents();
+        });
+        cout << "Rendered " << statistics.renderedDuration << "s in " << statistics.elapsedTime << "s ("
+             << statistics.getRealtimeFactor() << "x realtime)" << endl;
+        return 0;
+    }
+    // trade latency against headroom for slow blocks without rebuilding
+    size_t periodFrameCount = getenv("MIDI_SYNTH_PERIOD_FRAMES") ? strtoul(getenv("MIDI_SYNTH_PERIOD_FRAMES"), nullptr, 10) : defaultDevicePeriodFrameCount;
+    size_t renderBlockFrameCount = getenv("MIDI_SYNTH_RENDER_BLOCK_FRAMES") ? strtoul(getenv("MIDI_SYNTH_RENDER_BLOCK_FRAMES"), nullptr, 10) : defaultRenderBlockFrameCount;
+    size_t renderAheadFrameCount = getenv("MIDI_SYNTH_RENDER_AHEAD_FRAMES") ? strtoul(getenv("MIDI_SYNTH_RENDER_AHEAD_FRAMES"), nullptr, 10) : defaultRenderAheadFrameCount;
+    // device sample format: float (the default), 16 or 32
+    string deviceFormat = getenv("MIDI_SYNTH_DEVICE_FORMAT") ? getenv("MIDI_SYNTH_DEVICE_FORMAT") : "float";
+    DeviceSampleFormat deviceSampleFormat = deviceFormat == "16" ? DeviceSampleFormat::Int16
+        : deviceFormat == "32" ? DeviceSampleFormat::Int32
+        : DeviceSampleFormat::Float32;
+    auto audioOutput = makeDeviceAudioOutput(statistics, periodFrameCount, renderBlockFrameCount, renderAheadFrameCount, deviceSampleFormat, dither);
     audioOutput->bind(eventDispatcher);
     cout << "Running...\nPress enter to exit." << endl;
     cin.get();
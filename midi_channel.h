@@ -4,22 +4,118 @@
 #include "midi_key.h"
 #include <array>
 #include <iostream>
+#include <cstdint>
+
+class MidiChannel;
+
+/** @brief a polyphony limit shared by several channels
+ *
+ * When a note on would go over the limit a playing key is stolen from one of the channels.
+ * Keys that are fading out after being stolen don't count towards the limit;
+ * each fades out for at most getFadeOutTime().
+ */
+class PolyphonyManager
+{
+    friend class MidiChannel;
+    std::size_t maxPolyphony;
+    double fadeOutTime;
+    std::vector<MidiChannel *> channels;
+    std::uint64_t lastSerial;
+    std::uint64_t nextSerial()
+    {
+        return ++lastSerial;
+    }
+    void makeRoom();
+public:
+    static constexpr std::size_t unlimited = 0;
+    static constexpr double defaultFadeOutTime = 0.005;
+    /** @brief construct a polyphony manager
+     *
+     * @param maxPolyphony the maximum number of keys playing at once over all channels or unlimited
+     * @param fadeOutTime the time a stolen key fades out over
+     *
+     */
+    explicit PolyphonyManager(std::size_t maxPolyphony = unlimited, double fadeOutTime = defaultFadeOutTime)
+        : maxPolyphony(maxPolyphony), fadeOutTime(fadeOutTime), lastSerial(0)
+    {
+    }
+    PolyphonyManager(const PolyphonyManager &) = delete;
+    const PolyphonyManager &operator =(const PolyphonyManager &) = delete;
+    std::size_t getMaxPolyphony() const
+    {
+        return maxPolyphony;
+    }
+    void setMaxPolyphony(std::size_t maxPolyphony)
+    {
+        this->maxPolyphony = maxPolyphony;
+    }
+    double getFadeOutTime() const
+    {
+        return fadeOutTime;
+    }
+    void setFadeOutTime(double fadeOutTime)
+    {
+        this->fadeOutTime = fadeOutTime;
+    }
+};
 
 class MidiChannel : public AudioSource
 {
-    std::shared_ptr<MixAudioSource> mixer;
+    friend class PolyphonyManager;
+    static constexpr std::size_t initialPlayingKeyCapacity = 256;
+    /** keys quieter than this are stolen before held keys */
+    static constexpr float quietKeyAmplitude = 0.05;
+    struct PlayingKey
+    {
+        std::shared_ptr<MidiKey> key;
+        std::uint64_t noteOnSerial;
+        std::uint64_t releaseSerial;
+        PlayingKey(std::shared_ptr<MidiKey> key, std::uint64_t noteOnSerial)
+            : key(std::move(key)), noteOnSerial(noteOnSerial), releaseSerial(0)
+        {
+        }
+    };
+    static constexpr std::size_t keyGroupSize = 4;
+    std::shared_ptr<ParallelMixAudioSource> mixer;
     std::shared_ptr<AmplifyAudioSource> amplifier;
     std::shared_ptr<MidiInstrument> instrument;
+    std::shared_ptr<PolyphonyManager> polyphonyManager;
     std::array<std::shared_ptr<MidiKey>, maxKey + 1> keys;
-    std::list<std::shared_ptr<MidiKey>> playingKeys;
+    std::vector<PlayingKey> playingKeys;
+    std::size_t maxPolyphony;
     int slideFromKey;
     double currentPitchBendSemitones;
+    float silenceThreshold;
+    std::shared_ptr<RenderStatistics> statistics;
+    std::size_t statisticsChannelIndex;
 public:
-    MidiChannel(std::shared_ptr<MidiInstrument> instrument)
-        : instrument(std::move(instrument)), slideFromKey(invalidKey), currentPitchBendSemitones(0)
+    static constexpr std::size_t unlimited = PolyphonyManager::unlimited;
+    /** about -96 dBFS, the noise floor of 16 bit audio */
+    static constexpr float defaultSilenceThreshold = 1.6e-5;
+    /** @brief construct a midi channel
+     *
+     * @param instrument the instrument to play
+     * @param polyphonyManager the polyphony limit shared with other channels or nullptr for no shared limit
+     * @param maxPolyphony the maximum number of keys playing at once on this channel or unlimited
+     *
+     */
+    MidiChannel(std::shared_ptr<MidiInstrument> instrument, std::shared_ptr<PolyphonyManager> polyphonyManager = nullptr, std::size_t maxPolyphony = unlimited)
+        : instrument(std::move(instrument)), polyphonyManager(std::move(polyphonyManager)), maxPolyphony(maxPolyphony), slideFromKey(invalidKey), currentPitchBendSemitones(0), silenceThreshold(defaultSilenceThreshold), statisticsChannelIndex(0)
     {
-        mixer = std::make_shared<MixAudioSource>();
+        mixer = std::make_shared<ParallelMixAudioSource>(nullptr, (std::size_t)keyGroupSize);
         amplifier = std::make_shared<AmplifyAudioSource>(mixer, 1.0);
+        if(this->polyphonyManager == nullptr)
+            this->polyphonyManager = std::make_shared<PolyphonyManager>();
+        this->polyphonyManager->channels.push_back(this);
+        playingKeys.reserve(initialPlayingKeyCapacity);
+        mixer->reserve(initialPlayingKeyCapacity);
+    }
+    ~MidiChannel()
+    {
+        for(const PlayingKey &playingKey : playingKeys)
+            playingKey.key->retire();
+        std::vector<MidiChannel *> &channels = polyphonyManager->channels;
+        channels.erase(std::find(channels.begin(), channels.end(), this));
     }
     std::shared_ptr<MidiInstrument> getInstrument() const
     {
@@ -29,6 +125,53 @@ public:
     {
         this->instrument = std::move(instrument);
     }
+    /** @brief render groups of keys in parallel
+     *
+     * Keys only render in parallel when the channel isn't itself rendered as a task on threadPool.
+     *
+     * @param threadPool the threads to render on or nullptr to render on the calling thread
+     *
+     */
+    void setThreadPool(std::shared_ptr<RenderThreadPool> threadPool)
+    {
+        mixer->setThreadPool(std::move(threadPool));
+    }
+    std::size_t getMaxPolyphony() const
+    {
+        return maxPolyphony;
+    }
+    void setMaxPolyphony(std::size_t maxPolyphony)
+    {
+        this->maxPolyphony = maxPolyphony;
+    }
+    float getSilenceThreshold() const
+    {
+        return silenceThreshold;
+    }
+    /** @brief set the peak below which keys are retired even if they haven't finished
+     *
+     * Keys are checked with MidiKey::getPeakBound after every block, so a sustained key
+     * that has decayed below the threshold stops costing anything. The bound of a held key
+     * includes the most aftertouch can raise it, so a retired key could never have been heard again.
+     *
+     * @param silenceThreshold the threshold as a linear amplitude or 0 to only retire finished keys
+     *
+     */
+    void setSilenceThreshold(float silenceThreshold)
+    {
+        this->silenceThreshold = silenceThreshold;
+    }
+    /** @brief count voices started, stolen and retired and the voices playing after every block
+     *
+     * @param statistics the statistics to update or nullptr to stop updating
+     * @param channelIndex the channel to report playing voices as
+     *
+     */
+    void setStatistics(std::shared_ptr<RenderStatistics> statistics, std::size_t channelIndex)
+    {
+        this->statistics = std::move(statistics);
+        statisticsChannelIndex = channelIndex;
+    }
     void noteOff(int midiKey, int velocity = defaultVelocity)
     {
         if(!validMidiKey(midiKey))
@@ -36,8 +179,7 @@ public:
         //std::cout << "note off : " << midiKey << " : " << velocity << std::endl;
         if(keys[midiKey] == nullptr)
             return;
-        keys[midiKey]->stop(velocity);
-        keys[midiKey] = nullptr;
+        stopKey(midiKey, velocity);
     }
     void slideFrom(int midiKey)
     {
@@ -57,8 +199,7 @@ public:
         //std::cout << "note on : " << midiKey << " : " << velocity << std::endl;
         if(keys[midiKey] != nullptr)
         {
-            keys[midiKey]->stop();
-            keys[midiKey] = nullptr;
+            stopKey(midiKey);
         }
         if(validMidiKey(slideFromKey) && keys[slideFromKey] != nullptr)
         {
@@ -73,10 +214,20 @@ public:
             startKey = slideFromKey;
         slideFromKey = invalidKey;
         auto key = instrument->generate(startKey, velocity, currentPitchBendSemitones);
+        if(key == nullptr)
+        {
+            // every voice of the instrument is playing; it's never grown on the audio thread
+            if(statistics)
+                statistics->recordVoiceDropped();
+            return;
+        }
+        makeRoom();
         if(startKey != midiKey)
             key->slideTo(midiKey, velocity);
-        playingKeys.push_back(key);
+        playingKeys.push_back(PlayingKey(key, polyphonyManager->nextSerial()));
         mixer->insert(key, 1.0);
+        if(statistics)
+            statistics->recordVoiceStarted();
         keys[midiKey] = std::move(key);
     }
     void aftertouch(int midiKey, int velocity)
@@ -98,41 +249,219 @@ public:
     void setVolume(float newVolume)
     {
         if(playingKeys.empty()) // if nothing is playing then transition instantaneously
-            amplifier = std::make_shared<AmplifyAudioSource>(mixer, newVolume);
+            amplifier->resetAmplitude(newVolume);
         else
             amplifier->setAmplitude(newVolume, 10, AmplifyAudioSource::ScaleType::Exponential);
     }
+    void allNotesOff()
+    {
+        for(int midiKey = 0; midiKey <= maxKey; midiKey++)
+        {
+            if(keys[midiKey] != nullptr)
+                stopKey(midiKey);
+        }
+    }
+    /** @brief handle a control change message
+     *
+     * Supports channel volume and all notes off; other controllers are ignored.
+     *
+     * @param controller the controller number
+     * @param value the controller value from 0 to 127
+     *
+     */
+    void controlChange(int controller, int value)
+    {
+        switch(controller)
+        {
+        case 7: // channel volume
+            setVolume((float)value / 127);
+            break;
+        case 120: // all sound off
+        case 123: // all notes off
+            allNotesOff();
+            break;
+        default:
+            break;
+        }
+    }
     void pitchBend(double newPitchBendSemitones)
     {
         currentPitchBendSemitones = newPitchBendSemitones;
-        for(auto key : playingKeys)
+        for(const PlayingKey &playingKey : playingKeys)
         {
-            key->pitchBend(currentPitchBendSemitones);
+            playingKey.key->pitchBend(currentPitchBendSemitones);
         }
     }
     void advanceTime(double deltaTime) override
     {
         amplifier->advanceTime(deltaTime);
+        removeFinishedKeys();
+    }
+    float getCurrentSample(AudioChannel channel) override
+    {
+        return amplifier->getCurrentSample(channel);
+    }
+    float getPeakBound() override
+    {
+        return amplifier->getPeakBound();
+    }
+    bool render(float *output, std::size_t frameCount, double frameDuration) override
+    {
+        bool audible = amplifier->render(output, frameCount, frameDuration);
+        removeFinishedKeys();
+        if(statistics)
+            statistics->setActiveVoiceCount(statisticsChannelIndex, playingKeys.size());
+        return audible;
+    }
+    /** @brief count the keys that aren't fading out after being stolen
+     */
+    std::size_t getSoundingKeyCount() const
+    {
+        std::size_t retval = 0;
+        for(const PlayingKey &playingKey : playingKeys)
+        {
+            if(!playingKey.key->fadingOut())
+                retval++;
+        }
+        return retval;
+    }
+    virtual std::shared_ptr<AudioSource> duplicate() const override
+    {
+        throw std::runtime_error("non duplicable");
+    }
+private:
+    void stopKey(int midiKey, int velocity = defaultVelocity)
+    {
+        std::shared_ptr<MidiKey> key = std::move(keys[midiKey]);
+        keys[midiKey] = nullptr;
+        key->stop(velocity);
+        for(PlayingKey &playingKey : playingKeys)
+        {
+            if(playingKey.key == key && playingKey.releaseSerial == 0)
+                playingKey.releaseSerial = polyphonyManager->nextSerial();
+        }
+    }
+    void removeFinishedKeys()
+    {
         for(auto i = playingKeys.begin(); i != playingKeys.end();)
         {
-            auto key = *i;
-            if(key->finished())
+            auto key = i->key;
+            // the peak bound covers aftertouch, so a held key below the threshold stays inaudible and is retired too
+            if(key->finished() || key->getPeakBound() < silenceThreshold)
             {
                 i = playingKeys.erase(i);
                 mixer->erase(key);
+                // drop a retired key that is still held too, so its voice can go back to the pool
+                for(std::shared_ptr<MidiKey> &heldKey : keys)
+                {
+                    if(heldKey == key)
+                        heldKey = nullptr;
+                }
+                key->releaseResources();
+                key->retire();
+                if(statistics)
+                    statistics->recordVoiceRetired();
             }
             else
                 i++;
         }
     }
-    float getCurrentSample(AudioChannel channel) override
+    /** @brief rank keys for stealing: released keys first, then quiet keys, then held keys
+     */
+    static int getStealRank(const PlayingKey &playingKey)
     {
-        return amplifier->getCurrentSample(channel);
+        if(playingKey.releaseSerial != 0 || playingKey.key->released())
+            return 0;
+        if(playingKey.key->getAmplitude() < quietKeyAmplitude)
+            return 1;
+        return 2;
     }
-    virtual std::shared_ptr<AudioSource> duplicate() const override
+    static bool betterStealCandidate(const PlayingKey &a, const PlayingKey &b)
     {
-        throw std::runtime_error("non duplicable");
+        int rankA = getStealRank(a), rankB = getStealRank(b);
+        if(rankA != rankB)
+            return rankA < rankB;
+        switch(rankA)
+        {
+        case 0:
+            // oldest released
+            if(a.releaseSerial != b.releaseSerial)
+                return a.releaseSerial < b.releaseSerial;
+            break;
+        case 1:
+            // quietest
+            if(a.key->getAmplitude() != b.key->getAmplitude())
+                return a.key->getAmplitude() < b.key->getAmplitude();
+            break;
+        }
+        // oldest held
+        return a.noteOnSerial < b.noteOnSerial;
+    }
+    /** @brief find the key to steal
+     *
+     * @return the index in playingKeys of the key or playingKeys.size() if nothing can be stolen
+     *
+     */
+    std::size_t findStealCandidate() const
+    {
+        std::size_t retval = playingKeys.size();
+        for(std::size_t i = 0; i < playingKeys.size(); i++)
+        {
+            if(playingKeys[i].key->fadingOut())
+                continue;
+            if(retval == playingKeys.size() || betterStealCandidate(playingKeys[i], playingKeys[retval]))
+                retval = i;
+        }
+        return retval;
+    }
+    void stealKey(std::size_t index)
+    {
+        const std::shared_ptr<MidiKey> &key = playingKeys[index].key;
+        for(std::shared_ptr<MidiKey> &heldKey : keys)
+        {
+            if(heldKey == key)
+                heldKey = nullptr;
+        }
+        key->fadeOut(polyphonyManager->getFadeOutTime());
+        if(statistics)
+            statistics->recordVoiceStolen();
+    }
+    void makeRoom()
+    {
+        if(maxPolyphony != unlimited && getSoundingKeyCount() >= maxPolyphony)
+        {
+            std::size_t index = findStealCandidate();
+            if(index < playingKeys.size())
+                stealKey(index);
+        }
+        polyphonyManager->makeRoom();
     }
 };
 
+inline void PolyphonyManager::makeRoom()
+{
+    if(maxPolyphony == unlimited)
+        return;
+    std::size_t soundingKeyCount = 0;
+    for(MidiChannel *channel : channels)
+        soundingKeyCount += channel->getSoundingKeyCount();
+    if(soundingKeyCount < maxPolyphony)
+        return;
+    MidiChannel *victimChannel = nullptr;
+    std::size_t victimIndex = 0;
+    for(MidiChannel *channel : channels)
+    {
+        std::size_t index = channel->findStealCandidate();
+        if(index >= channel->playingKeys.size())
+            continue;
+        if(victimChannel == nullptr || MidiChannel::betterStealCandidate(channel->playingKeys[index], victimChannel->playingKeys[victimIndex]))
+        {
+            victimChannel = channel;
+            victimIndex = index;
+        }
+    }
+    if(victimChannel != nullptr)
+        victimChannel->stealKey(victimIndex);
+}
+
 #endif // MIDI_CHANNEL_H_INCLUDED
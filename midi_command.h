@@ -0,0 +1,305 @@
+#ifndef MIDI_COMMAND_H_INCLUDED
+#define MIDI_COMMAND_H_INCLUDED
+
+#include "midi_channel.h"
+#include "midi_instrument_provider.h"
+#include "lock_free_queue.h"
+#include <array>
+#include <cstdint>
+
+constexpr int midiChannelCount = 16;
+
+/** @brief a midi message for a channel of a MidiChannelBank
+ */
+struct MidiCommand
+{
+    enum class Type : std::uint8_t
+    {
+        NoteOn,
+        NoteOff,
+        Aftertouch,
+        ChannelAftertouch,
+        ControlChange,
+        ProgramChange,
+        PitchBend,
+        SetVolume,
+    };
+    Type type;
+    std::uint8_t channel;
+    /** the midi key, controller or program number */
+    int number;
+    /** the velocity or controller value */
+    int value;
+    /** the pitch bend in semitones or the volume */
+    double amount;
+    /** the time to apply the command at; commands due before the current block apply at its start */
+    double time;
+    MidiCommand()
+        : type(Type::NoteOff), channel(0), number(0), value(0), amount(0), time(0)
+    {
+    }
+    MidiCommand(Type type, int channel, int number, int value, double amount = 0)
+        : type(type), channel(channel), number(number), value(value), amount(amount), time(0)
+    {
+    }
+    /** @brief get this command at a different time
+     *
+     * @param time the time in the EventDispatcherAudioSource's time
+     * @return the new command
+     *
+     */
+    MidiCommand at(double time) const
+    {
+        MidiCommand retval = *this;
+        retval.time = time;
+        return retval;
+    }
+    /** @brief check if only the last of several of these commands in a row matters
+     */
+    bool continuous() const
+    {
+        switch(type)
+        {
+        case Type::Aftertouch:
+        case Type::ChannelAftertouch:
+        case Type::ControlChange:
+        case Type::PitchBend:
+        case Type::SetVolume:
+            return true;
+        default:
+            return false;
+        }
+    }
+    static MidiCommand noteOn(int channel, int midiKey, int velocity)
+    {
+        return MidiCommand(Type::NoteOn, channel, midiKey, velocity);
+    }
+    static MidiCommand noteOff(int channel, int midiKey, int velocity = defaultVelocity)
+    {
+        return MidiCommand(Type::NoteOff, channel, midiKey, velocity);
+    }
+    static MidiCommand aftertouch(int channel, int midiKey, int velocity)
+    {
+        return MidiCommand(Type::Aftertouch, channel, midiKey, velocity);
+    }
+    static MidiCommand channelAftertouch(int channel, int velocity)
+    {
+        return MidiCommand(Type::ChannelAftertouch, channel, 0, velocity);
+    }
+    static MidiCommand controlChange(int channel, int controller, int value)
+    {
+        return MidiCommand(Type::ControlChange, channel, controller, value);
+    }
+    static MidiCommand programChange(int channel, int program)
+    {
+        return MidiCommand(Type::ProgramChange, channel, program, 0);
+    }
+    static MidiCommand pitchBend(int channel, double semitones)
+    {
+        return MidiCommand(Type::PitchBend, channel, 0, 0, semitones);
+    }
+    static MidiCommand setVolume(int channel, double volume)
+    {
+        return MidiCommand(Type::SetVolume, channel, 0, 0, volume);
+    }
+};
+
+/** @brief the 16 channels of a midi device mixed together
+ */
+class MidiChannelBank : public AudioSource
+{
+    std::shared_ptr<MidiInstrumentProvider> instrumentProvider;
+    std::array<std::shared_ptr<MidiChannel>, midiChannelCount> channels;
+    std::shared_ptr<ParallelMixAudioSource> mixer;
+public:
+    /** @brief construct a midi channel bank
+     *
+     * Every channel starts with program 0.
+     *
+     * @param instrumentProvider the instruments for program changes
+     * @param polyphonyManager the polyphony limit shared by the channels or nullptr for no limit
+     * @param threadPool the threads to render the channels on or nullptr to render on the calling thread
+     *
+     */
+    MidiChannelBank(std::shared_ptr<MidiInstrumentProvider> instrumentProvider, std::shared_ptr<PolyphonyManager> polyphonyManager = nullptr, std::shared_ptr<RenderThreadPool> threadPool = nullptr)
+        : instrumentProvider(std::move(instrumentProvider))
+    {
+        if(polyphonyManager == nullptr)
+            polyphonyManager = std::make_shared<PolyphonyManager>();
+        mixer = std::make_shared<ParallelMixAudioSource>(threadPool);
+        for(std::shared_ptr<MidiChannel> &channel : channels)
+        {
+            channel = std::make_shared<MidiChannel>(this->instrumentProvider->getInstrument(0), polyphonyManager);
+            channel->setThreadPool(threadPool);
+            mixer->insert(channel, 1.0);
+        }
+    }
+    const std::shared_ptr<MidiChannel> &getChannel(int channel) const
+    {
+        return channels.at(channel);
+    }
+    /** @brief report the voices of every channel
+     *
+     * @param statistics the statistics to update or nullptr to stop updating
+     *
+     */
+    void setStatistics(std::shared_ptr<RenderStatistics> statistics)
+    {
+        for(std::size_t i = 0; i < channels.size(); i++)
+            channels[i]->setStatistics(statistics, i);
+    }
+    /** @brief set the peak below which every channel retires keys
+     *
+     * @param silenceThreshold the threshold as a linear amplitude or 0 to only retire finished keys
+     *
+     */
+    void setSilenceThreshold(float silenceThreshold)
+    {
+        for(const std::shared_ptr<MidiChannel> &channel : channels)
+            channel->setSilenceThreshold(silenceThreshold);
+    }
+    /** @brief apply a command
+     *
+     * Commands for channels out of range are ignored.
+     *
+     * @param command the command to apply
+     *
+     */
+    void apply(const MidiCommand &command)
+    {
+        if(command.channel >= midiChannelCount)
+            return;
+        MidiChannel &channel = *channels[command.channel];
+        switch(command.type)
+        {
+        case MidiCommand::Type::NoteOn:
+            channel.noteOn(command.number, command.value);
+            break;
+        case MidiCommand::Type::NoteOff:
+            channel.noteOff(command.number, command.value);
+            break;
+        case MidiCommand::Type::Aftertouch:
+            channel.aftertouch(command.number, command.value);
+            break;
+        case MidiCommand::Type::ChannelAftertouch:
+            channel.aftertouchAll(command.value);
+            break;
+        case MidiCommand::Type::ControlChange:
+            channel.controlChange(command.number, command.value);
+            break;
+        case MidiCommand::Type::ProgramChange:
+            channel.setInstrument(instrumentProvider->getInstrument(command.number));
+            break;
+        case MidiCommand::Type::PitchBend:
+            channel.pitchBend(command.amount);
+            break;
+        case MidiCommand::Type::SetVolume:
+            channel.setVolume(command.amount);
+            break;
+        }
+    }
+    void advanceTime(double deltaTime) override
+    {
+        mixer->advanceTime(deltaTime);
+    }
+    float getCurrentSample(AudioChannel channel) override
+    {
+        return mixer->getCurrentSample(channel);
+    }
+    float getPeakBound() override
+    {
+        return mixer->getPeakBound();
+    }
+    bool render(float *output, std::size_t frameCount, double frameDuration) override
+    {
+        return mixer->render(output, frameCount, frameDuration);
+    }
+    virtual std::shared_ptr<AudioSource> duplicate() const override
+    {
+        throw std::runtime_error("non duplicable");
+    }
+};
+
+/** @brief a queue of midi commands posted by control threads and applied on the audio thread
+ *
+ * Add it to an EventDispatcherAudioSource with addCommandSource.
+ * Posting never waits on rendering and dispatching never waits on control threads.
+ * Commands have to be posted in time order; the dispatcher splits its blocks at their times.
+ * Continuous commands that land on the same frame are coalesced so only the last one is applied.
+ *
+ * @param Queue SpscQueue<MidiCommand> for one control thread or MpscQueue<MidiCommand> for several
+ */
+template <typename Queue>
+class BasicMidiCommandQueue : public CommandSource
+{
+    std::shared_ptr<MidiChannelBank> channelBank;
+    Queue queue;
+    std::vector<MidiCommand> dueCommands;
+    /** @brief check if a later due command on the same channel replaces a continuous command
+     */
+    bool superseded(std::size_t index, std::size_t dueCommandCount) const
+    {
+        const MidiCommand &command = dueCommands[index];
+        for(std::size_t i = index + 1; i < dueCommandCount; i++)
+        {
+            const MidiCommand &later = dueCommands[i];
+            if(later.channel != command.channel)
+                continue;
+            if(later.type == command.type && later.number == command.number)
+                return true;
+            // notes pick up the current pitch bend, aftertouch and volume
+            if(!later.continuous())
+                return false;
+        }
+        return false;
+    }
+public:
+    static constexpr std::size_t defaultCapacity = 4096;
+    explicit BasicMidiCommandQueue(std::shared_ptr<MidiChannelBank> channelBank, std::size_t capacity = defaultCapacity)
+        : channelBank(std::move(channelBank)), queue(capacity), dueCommands(capacity)
+    {
+    }
+    /** @brief post a command to apply at its time
+     *
+     * @param command the command; its time must not be before the time of the last posted command
+     * @return false if the queue is full and the command was dropped
+     *
+     */
+    bool post(const MidiCommand &command)
+    {
+        return queue.push(command);
+    }
+    virtual void dispatchCommands(double currentTime) override
+    {
+        while(true)
+        {
+            std::size_t dueCommandCount = 0;
+            for(const MidiCommand *command = queue.front(); command != nullptr && command->time <= currentTime && dueCommandCount < dueCommands.size(); command = queue.front())
+                queue.pop(dueCommands[dueCommandCount++]);
+            if(dueCommandCount == 0)
+                return;
+            for(std::size_t i = 0; i < dueCommandCount; i++)
+            {
+                if(dueCommands[i].continuous() && superseded(i, dueCommandCount))
+                    continue;
+                channelBank->apply(dueCommands[i]);
+            }
+        }
+    }
+    virtual std::size_t getPendingCommandCount() override
+    {
+        return queue.size();
+    }
+    virtual double getNextCommandTime() override
+    {
+        const MidiCommand *command = queue.front();
+        if(command == nullptr)
+            return INFINITY;
+        return command->time;
+    }
+};
+
+typedef BasicMidiCommandQueue<MpscQueue<MidiCommand>> MidiCommandQueue;
+typedef BasicMidiCommandQueue<SpscQueue<MidiCommand>> SingleProducerMidiCommandQueue;
+
+#endif // MIDI_COMMAND_H_INCLUDED
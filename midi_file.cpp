@@ -0,0 +1,262 @@
+#include "midi_file.h"
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <cstring>
+
+using namespace std;
+
+namespace
+{
+uint32_t readBigEndian(const uint8_t *bytes, size_t byteCount)
+{
+    uint32_t retval = 0;
+    for(size_t i = 0; i < byteCount; i++)
+        retval = (retval << 8) | bytes[i];
+    return retval;
+}
+
+constexpr uint8_t metaEventStatus = 0xFF;
+constexpr uint8_t metaEndOfTrack = 0x2F;
+constexpr uint8_t metaSetTempo = 0x51;
+constexpr int nullRegisteredParameter = 0x3FFF;
+constexpr int pitchBendSensitivity = 0;
+}
+
+bool MidiFile::TrackReader::readVariableLength(std::uint32_t &value)
+{
+    value = 0;
+    for(int i = 0; i < 4; i++)
+    {
+        if(position == end)
+            return false;
+        uint8_t byte = *position++;
+        value = (value << 7) | (byte & 0x7F);
+        if((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool MidiFile::TrackReader::read(Event &event)
+{
+    if(position == end)
+        return false;
+    uint32_t deltaTime;
+    if(!readVariableLength(deltaTime))
+        return fail();
+    tick += deltaTime;
+    event.tick = tick;
+    if(position == end)
+        return fail();
+    uint8_t status = *position;
+    if(status < 0x80)
+    {
+        if(runningStatus == 0)
+            return fail();
+        status = runningStatus;
+    }
+    else
+        position++;
+    event.status = status;
+    if(status == metaEventStatus || status == 0xF0 || status == 0xF7)
+    {
+        event.metaType = 0;
+        if(status == metaEventStatus)
+        {
+            if(position == end)
+                return fail();
+            event.metaType = *position++;
+        }
+        else
+            runningStatus = 0;
+        uint32_t length;
+        if(!readVariableLength(length) || (size_t)(end - position) < length)
+            return fail();
+        event.metaData = position;
+        event.metaLength = length;
+        position += length;
+        if(status == metaEventStatus && event.metaType == metaEndOfTrack)
+            position = end;
+        return true;
+    }
+    if(status >= 0xF0) // system common messages don't appear in files
+        return fail();
+    runningStatus = status;
+    size_t dataByteCount = ((status & 0xF0) == 0xC0 || (status & 0xF0) == 0xD0) ? 1 : 2;
+    if((size_t)(end - position) < dataByteCount)
+        return fail();
+    event.data[0] = *position++ & 0x7F;
+    event.data[1] = dataByteCount == 2 ? *position++ & 0x7F : 0;
+    event.metaType = 0;
+    event.metaData = nullptr;
+    event.metaLength = 0;
+    return true;
+}
+
+MidiFile::MidiFile(std::string fileName)
+{
+    ifstream is(fileName.c_str(), ios::binary);
+    if(!is)
+        throw runtime_error("can't open file : " + fileName);
+    data.assign(istreambuf_iterator<char>(is), istreambuf_iterator<char>());
+    if(data.size() < 14 || memcmp(&data[0], "MThd", 4) != 0)
+        throw runtime_error("invalid format : " + fileName);
+    size_t headerLength = readBigEndian(&data[4], 4);
+    if(headerLength < 6 || headerLength > data.size() - 8)
+        throw runtime_error("invalid format : " + fileName);
+    format = readBigEndian(&data[8], 2);
+    division = (int16_t)readBigEndian(&data[12], 2);
+    if(format > 1)
+        throw runtime_error("unsupported midi file : " + fileName);
+    if(division == 0 || (division < 0 && (division & 0xFF) == 0))
+        throw runtime_error("invalid format : " + fileName);
+    size_t offset = 8 + headerLength;
+    while(data.size() - offset >= 8)
+    {
+        size_t length = readBigEndian(&data[offset + 4], 4);
+        if(length > data.size() - offset - 8)
+            throw runtime_error("invalid format : " + fileName);
+        // unknown chunk types are skipped
+        if(memcmp(&data[offset], "MTrk", 4) == 0)
+            tracks.push_back(make_pair(offset + 8, offset + 8 + length));
+        offset += 8 + length;
+    }
+    if(tracks.empty())
+        throw runtime_error("invalid format : " + fileName);
+    for(size_t i = 0; i < tracks.size(); i++)
+    {
+        TrackReader reader = getTrack(i);
+        Event event;
+        while(reader.read(event))
+        {
+        }
+        if(!reader.isValid())
+            throw runtime_error("invalid format : " + fileName);
+    }
+}
+
+double MidiFile::getTickDuration(std::uint32_t tempo) const
+{
+    if(division > 0)
+        return tempo * 1e-6 / division;
+    // SMPTE: the high byte is minus the frames per second and the low byte is the ticks per frame
+    int framesPerSecond = -(division >> 8);
+    int ticksPerFrame = division & 0xFF;
+    double frameRate = framesPerSecond == 29 ? 30000.0 / 1001 : framesPerSecond;
+    return 1 / (frameRate * ticksPerFrame);
+}
+
+constexpr std::uint32_t MidiFilePlayer::defaultTempo;
+constexpr double MidiFilePlayer::defaultPitchBendRange;
+
+MidiFilePlayer::MidiFilePlayer(std::shared_ptr<const MidiFile> file, std::shared_ptr<MidiChannelBank> channelBank, double startTime)
+    : file(std::move(file)), channelBank(std::move(channelBank)), lastTick(0), lastTickTime(startTime)
+{
+    tickDuration = this->file->getTickDuration(defaultTempo);
+    tracks.resize(this->file->getTrackCount());
+    for(size_t i = 0; i < tracks.size(); i++)
+    {
+        tracks[i].reader = this->file->getTrack(i);
+        tracks[i].hasNextEvent = tracks[i].reader.read(tracks[i].nextEvent);
+    }
+    for(ChannelState &channel : channels)
+    {
+        channel.registeredParameter = nullRegisteredParameter;
+        channel.pitchBendRange = defaultPitchBendRange;
+    }
+}
+
+MidiFilePlayer::TrackState *MidiFilePlayer::getNextTrack()
+{
+    // on ties the earlier track goes first so the tempo track of a format 1 file leads
+    TrackState *retval = nullptr;
+    for(TrackState &track : tracks)
+    {
+        if(track.hasNextEvent && (retval == nullptr || track.nextEvent.tick < retval->nextEvent.tick))
+            retval = &track;
+    }
+    return retval;
+}
+
+void MidiFilePlayer::play(const MidiFile::Event &event)
+{
+    if(event.status == metaEventStatus)
+    {
+        if(event.metaType == metaSetTempo && event.metaLength == 3)
+            tickDuration = file->getTickDuration(readBigEndian(event.metaData, 3));
+        return;
+    }
+    if(event.status >= 0xF0)
+        return;
+    int channel = event.status & 0x0F;
+    ChannelState &channelState = channels[channel];
+    switch(event.status & 0xF0)
+    {
+    case 0x80:
+        channelBank->apply(MidiCommand::noteOff(channel, event.data[0], event.data[1]));
+        break;
+    case 0x90:
+        if(event.data[1] == 0)
+            channelBank->apply(MidiCommand::noteOff(channel, event.data[0]));
+        else
+            channelBank->apply(MidiCommand::noteOn(channel, event.data[0], event.data[1]));
+        break;
+    case 0xA0:
+        channelBank->apply(MidiCommand::aftertouch(channel, event.data[0], event.data[1]));
+        break;
+    case 0xB0:
+        switch(event.data[0])
+        {
+        case 101: // registered parameter number msb
+            channelState.registeredParameter = (event.data[1] << 7) | (channelState.registeredParameter & 0x7F);
+            break;
+        case 100: // registered parameter number lsb
+            channelState.registeredParameter = (channelState.registeredParameter & ~0x7F) | event.data[1];
+            break;
+        case 6: // data entry msb
+            if(channelState.registeredParameter == pitchBendSensitivity)
+                channelState.pitchBendRange = event.data[1];
+            break;
+        case 38: // data entry lsb
+            if(channelState.registeredParameter == pitchBendSensitivity)
+                channelState.pitchBendRange = (int)channelState.pitchBendRange + event.data[1] / 100.0;
+            break;
+        default:
+            break;
+        }
+        channelBank->apply(MidiCommand::controlChange(channel, event.data[0], event.data[1]));
+        break;
+    case 0xC0:
+        channelBank->apply(MidiCommand::programChange(channel, event.data[0]));
+        break;
+    case 0xD0:
+        channelBank->apply(MidiCommand::channelAftertouch(channel, event.data[0]));
+        break;
+    case 0xE0:
+    {
+        int value = (event.data[1] << 7) | event.data[0];
+        channelBank->apply(MidiCommand::pitchBend(channel, (value - 8192) / 8192.0 * channelState.pitchBendRange));
+        break;
+    }
+    }
+}
+
+void MidiFilePlayer::dispatchCommands(double currentTime)
+{
+    for(TrackState *track = getNextTrack(); track != nullptr && getEventTime(track->nextEvent) <= currentTime; track = getNextTrack())
+    {
+        lastTickTime = getEventTime(track->nextEvent);
+        lastTick = track->nextEvent.tick;
+        play(track->nextEvent);
+        track->hasNextEvent = track->reader.read(track->nextEvent);
+    }
+}
+
+double MidiFilePlayer::getNextCommandTime()
+{
+    TrackState *track = getNextTrack();
+    if(track == nullptr)
+        return INFINITY;
+    return getEventTime(track->nextEvent);
+}
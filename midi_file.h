@@ -0,0 +1,159 @@
+#ifndef MIDI_FILE_H_INCLUDED
+#define MIDI_FILE_H_INCLUDED
+
+#include "midi_command.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/** @brief a standard midi file of format 0 or 1
+ *
+ * The file is checked when it is loaded but the tracks are only decoded while playing.
+ */
+class MidiFile
+{
+public:
+    struct Event
+    {
+        /** the time in ticks from the start of the track */
+        std::uint64_t tick;
+        /** the status byte; 0xFF for meta events */
+        std::uint8_t status;
+        /** the data bytes of channel messages */
+        std::uint8_t data[2];
+        std::uint8_t metaType;
+        const std::uint8_t *metaData;
+        std::uint32_t metaLength;
+    };
+    /** @brief decodes the events of a track one at a time
+     */
+    class TrackReader
+    {
+        const std::uint8_t *position;
+        const std::uint8_t *end;
+        std::uint64_t tick;
+        std::uint8_t runningStatus;
+        bool valid;
+        bool readVariableLength(std::uint32_t &value);
+        bool fail()
+        {
+            valid = false;
+            position = end;
+            return false;
+        }
+    public:
+        TrackReader()
+            : position(nullptr), end(nullptr), tick(0), runningStatus(0), valid(true)
+        {
+        }
+        TrackReader(const std::uint8_t *begin, const std::uint8_t *end)
+            : position(begin), end(end), tick(0), runningStatus(0), valid(true)
+        {
+        }
+        /** @brief read the next event
+         *
+         * @param event set to the event read
+         * @return false at the end of the track or if the track is invalid
+         *
+         */
+        bool read(Event &event);
+        bool finished() const
+        {
+            return position == end;
+        }
+        /** @brief check if the events read so far were valid
+         */
+        bool isValid() const
+        {
+            return valid;
+        }
+    };
+private:
+    std::vector<std::uint8_t> data;
+    /** the start and end of each track in data */
+    std::vector<std::pair<std::size_t, std::size_t>> tracks;
+    int format;
+    std::int16_t division;
+public:
+    /** @brief load a midi file
+     *
+     * @param fileName the file to load
+     * @throw std::runtime_error if the file can't be read or isn't a valid format 0 or 1 midi file
+     *
+     */
+    explicit MidiFile(std::string fileName);
+    int getFormat() const
+    {
+        return format;
+    }
+    std::size_t getTrackCount() const
+    {
+        return tracks.size();
+    }
+    TrackReader getTrack(std::size_t track) const
+    {
+        return TrackReader(data.data() + tracks[track].first, data.data() + tracks[track].second);
+    }
+    /** @brief get the length of a tick
+     *
+     * @param tempo the tempo in microseconds per quarter note; ignored for SMPTE time division
+     * @return the tick duration in seconds
+     *
+     */
+    double getTickDuration(std::uint32_t tempo) const;
+};
+
+/** @brief plays a MidiFile on a MidiChannelBank
+ *
+ * Add it to an EventDispatcherAudioSource with addCommandSource.
+ * Only the next event of every track is decoded ahead of playback,
+ * so playing a long file doesn't take more memory than a short one.
+ */
+class MidiFilePlayer : public CommandSource
+{
+    struct TrackState
+    {
+        MidiFile::TrackReader reader;
+        MidiFile::Event nextEvent;
+        bool hasNextEvent;
+    };
+    struct ChannelState
+    {
+        /** the selected registered parameter: (msb << 7) | lsb */
+        int registeredParameter;
+        double pitchBendRange;
+    };
+    std::shared_ptr<const MidiFile> file;
+    std::shared_ptr<MidiChannelBank> channelBank;
+    std::vector<TrackState> tracks;
+    ChannelState channels[midiChannelCount];
+    /** the tick of the last event played and its time */
+    std::uint64_t lastTick;
+    double lastTickTime;
+    double tickDuration;
+    TrackState *getNextTrack();
+    double getEventTime(const MidiFile::Event &event) const
+    {
+        return lastTickTime + (event.tick - lastTick) * tickDuration;
+    }
+    void play(const MidiFile::Event &event);
+public:
+    static constexpr std::uint32_t defaultTempo = 500000;
+    static constexpr double defaultPitchBendRange = 2;
+    /** @brief construct a midi file player
+     *
+     * @param file the file to play
+     * @param channelBank the channels to play on
+     * @param startTime the time in the EventDispatcherAudioSource's time to start playing at
+     *
+     */
+    MidiFilePlayer(std::shared_ptr<const MidiFile> file, std::shared_ptr<MidiChannelBank> channelBank, double startTime = 0);
+    bool finished()
+    {
+        return getNextTrack() == nullptr;
+    }
+    virtual void dispatchCommands(double currentTime) override;
+    virtual double getNextCommandTime() override;
+};
+
+#endif // MIDI_FILE_H_INCLUDED
@@ -20,7 +20,7 @@ class GenericMidiInstrumentProvider : public MidiInstrumentProvider
     std::shared_ptr<MidiInstrument> silentInstrument;
 public:
     GenericMidiInstrumentProvider()
-        : silentInstrument(std::make_shared<SelectMidiInstrument>())
+        : silentInstrument(std::make_shared<SelectMidiInstrument>("Silence"))
     {
     }
     void insert(int instrumentNumber, std::shared_ptr<MidiInstrument> instrument)
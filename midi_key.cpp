@@ -1,7 +1,14 @@
 #include "midi_key.h"
+#include "audio_data_cache.h"
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <stdexcept>
+#include <vector>
 
 using namespace std;
 
@@ -16,7 +23,7 @@ void skipComments(istream &is)
 }
 }
 
-std::shared_ptr<MidiInstrument> loadFromDirectory(std::string path)
+SampledInstrumentDescription parseInstrumentDirectory(std::string path)
 {
     if(path == "")
         path = ".";
@@ -28,71 +35,140 @@ std::shared_ptr<MidiInstrument> loadFromDirectory(std::string path)
     if(!keys)
         throw runtime_error("can't open file : " + keysPath);
     skipComments(keys);
-    string name;
-    if(!getline(keys, name))
+    SampledInstrumentDescription retval;
+    if(!getline(keys, retval.name))
         throw runtime_error("invalid format : " + keysPath);
-    shared_ptr<SelectMidiInstrument> retval = make_shared<SelectMidiInstrument>(name);
     for(string keyFileName; getline(keys, keyFileName); )
     {
         if(keyFileName == "")
             continue;
         string keyPath = path + keyFileName;
-        ifstream key(keyPath.c_str());
-        if(!key)
+        ifstream keyFile(keyPath.c_str());
+        if(!keyFile)
             throw runtime_error("can't open file : " + keyFileName);
-        skipComments(key);
-        shared_ptr<MixAudioSource> keyAudioSource = make_shared<MixAudioSource>();
+        skipComments(keyFile);
         string keyProperties;
-        if(!getline(key, keyProperties))
+        if(!getline(keyFile, keyProperties))
             throw runtime_error("invalid format : " + keyPath);
         istringstream keyPropertiesStream(keyProperties);
-        double sourceBaseKey;
-        double attackSpeed;
-        double decaySpeed;
-        double sustainSpeed;
-        double releaseSpeed;
-        double releaseSpeedVariance;
-        double slideSpeed;
-        double aftertouchSpeed;
-        float attackAmplitude;
-        float decayAmplitude;
-        size_t loopStart, loopEnd;
-        double loopDecayAmplitude;
-        int startKey, endKey;
-        if(!(keyPropertiesStream >> sourceBaseKey >> attackSpeed >> decaySpeed >> sustainSpeed >> releaseSpeed >> releaseSpeedVariance >> slideSpeed >> aftertouchSpeed >> attackAmplitude >> decayAmplitude >> loopStart >> loopEnd >> loopDecayAmplitude >> startKey >> endKey))
+        SampledInstrumentDescription::Key key;
+        if(!(keyPropertiesStream >> key.sourceBaseKey >> key.attackSpeed >> key.decaySpeed >> key.sustainSpeed >> key.releaseSpeed >> key.releaseSpeedVariance >> key.slideSpeed >> key.aftertouchSpeed >> key.attackAmplitude >> key.decayAmplitude >> key.loopStart >> key.loopEnd >> key.loopDecayAmplitude >> key.startKey >> key.endKey))
             throw runtime_error("invalid format : " + keyPath);
-        if(attackSpeed < 0)
-            attackSpeed = GenericMidiKey::InstantaneousAttack;
-        for(string audioFileName; getline(key, audioFileName); )
+        if(key.attackSpeed < 0)
+            key.attackSpeed = GenericMidiKey::InstantaneousAttack;
+        for(string audioFileName; getline(keyFile, audioFileName); )
         {
             //cout << audioFileName << endl;
             if(audioFileName == "")
                 break;
-            string audioFilePath = path + audioFileName;
-            shared_ptr<AudioData> audioData = loadFromOgg(audioFilePath);
-            if(!audioData)
-                throw runtime_error("can't open file : " + audioFilePath);
-            if(loopEnd > 0)
-            {
-                audioData->data.resize(loopEnd);
-                audioData->looped = true;
-                audioData->loopStart = loopStart;
-            }
-            array_AudioChannel<float> channelAmplitudes;
+            SampledInstrumentDescription::AudioFile audioFile;
+            audioFile.path = path + audioFileName;
             string audioProperties;
-            if(!getline(key, audioProperties))
-                throw runtime_error("can't open file : " + audioFilePath);
+            if(!getline(keyFile, audioProperties))
+                throw runtime_error("can't open file : " + audioFile.path);
             istringstream audioPropertiesStream(audioProperties);
-            for(float &v : channelAmplitudes)
+            for(float &v : audioFile.channelAmplitudes)
             {
                 audioPropertiesStream >> v;
             }
             if(!audioPropertiesStream)
-                throw runtime_error("can't open file : " + audioFilePath);
-            keyAudioSource->insert(make_shared<PanAudioSource>(make_shared<SampledAudioSource>(audioData), channelAmplitudes), 1.0);
+                throw runtime_error("can't open file : " + audioFile.path);
+            key.audioFiles.push_back(std::move(audioFile));
         }
-        shared_ptr<MidiInstrument> keyInstrument = make_shared<GenericMidiInstrument>(name, keyAudioSource, sourceBaseKey, attackSpeed, decaySpeed, sustainSpeed, releaseSpeed, releaseSpeedVariance, slideSpeed, aftertouchSpeed, attackAmplitude, decayAmplitude);
-        retval->addRange(SelectMidiInstrument::Range(keyInstrument, startKey, endKey));
+        retval.keys.push_back(std::move(key));
     }
     return retval;
 }
+
+std::shared_ptr<AudioData> loadInstrumentAudio(const SampledInstrumentDescription::Key &key, const SampledInstrumentDescription::AudioFile &audioFile, AudioData::SampleFormat sampleFormat, std::size_t mipLevelCount)
+{
+    shared_ptr<AudioData> audioData = AudioDataCache::getDefault().load(audioFile.path, key.loopStart, key.loopEnd, sampleFormat, mipLevelCount);
+    if(!audioData)
+        throw runtime_error("can't open file : " + audioFile.path);
+    return audioData;
+}
+
+void loadInstrumentAudio(SampledInstrumentDescription &description, unsigned threadCount, AudioData::SampleFormat sampleFormat, std::size_t mipLevelCount)
+{
+    struct Job
+    {
+        const SampledInstrumentDescription::Key *key;
+        SampledInstrumentDescription::AudioFile *audioFile;
+        exception_ptr error;
+    };
+    vector<Job> jobs;
+    for(SampledInstrumentDescription::Key &key : description.keys)
+    {
+        for(SampledInstrumentDescription::AudioFile &audioFile : key.audioFiles)
+        {
+            jobs.push_back(Job{&key, &audioFile, nullptr});
+        }
+    }
+    if(threadCount == 0)
+        threadCount = max(1u, thread::hardware_concurrency());
+    if(threadCount > jobs.size())
+        threadCount = jobs.size();
+    atomic_size_t nextJob(0);
+    atomic_bool failed(false);
+    auto worker = [&]()
+    {
+        for(size_t i = nextJob++; i < jobs.size() && !failed.load(memory_order_relaxed); i = nextJob++)
+        {
+            Job &job = jobs[i];
+            auto startTime = chrono::steady_clock::now();
+            try
+            {
+                job.audioFile->audioData = loadInstrumentAudio(*job.key, *job.audioFile, sampleFormat, mipLevelCount);
+            }
+            catch(exception &e)
+            {
+                double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - startTime).count();
+                ostringstream ss;
+                ss << e.what() << " (failed after " << elapsed << " ms)";
+                job.error = make_exception_ptr(runtime_error(ss.str()));
+                failed = true;
+            }
+            catch(...)
+            {
+                job.error = current_exception();
+                failed = true;
+            }
+        }
+    };
+    vector<thread> threads;
+    for(unsigned i = 1; i < threadCount; i++)
+        threads.emplace_back(worker);
+    worker();
+    for(thread &t : threads)
+        t.join();
+    for(const Job &job : jobs)
+    {
+        if(job.error)
+            rethrow_exception(job.error);
+    }
+}
+
+std::shared_ptr<MidiInstrument> makeSampledInstrument(const SampledInstrumentDescription &description, InterpolationMode interpolationMode, std::size_t voicePoolSize)
+{
+    shared_ptr<SelectMidiInstrument> retval = make_shared<SelectMidiInstrument>(description.name);
+    vector<SelectMidiInstrument::Range> ranges;
+    for(const SampledInstrumentDescription::Key &key : description.keys)
+    {
+        shared_ptr<MixAudioSource> keyAudioSource = make_shared<MixAudioSource>();
+        for(const SampledInstrumentDescription::AudioFile &audioFile : key.audioFiles)
+        {
+            keyAudioSource->insert(make_shared<PanAudioSource>(make_shared<SampledAudioSource>(audioFile.audioData, interpolationMode), audioFile.channelAmplitudes), 1.0);
+        }
+        shared_ptr<MidiInstrument> keyInstrument = make_shared<GenericMidiInstrument>(description.name, keyAudioSource, key.sourceBaseKey, key.attackSpeed, key.decaySpeed, key.sustainSpeed, key.releaseSpeed, key.releaseSpeedVariance, key.slideSpeed, key.aftertouchSpeed, key.attackAmplitude, key.decayAmplitude, voicePoolSize);
+        ranges.push_back(SelectMidiInstrument::Range(keyInstrument, key.startKey, key.endKey));
+    }
+    retval->addRanges(std::move(ranges));
+    return retval;
+}
+
+std::shared_ptr<MidiInstrument> loadFromDirectory(std::string path, unsigned threadCount, AudioData::SampleFormat sampleFormat, InterpolationMode interpolationMode, std::size_t mipLevelCount)
+{
+    SampledInstrumentDescription description = parseInstrumentDirectory(std::move(path));
+    loadInstrumentAudio(description, threadCount, sampleFormat, mipLevelCount);
+    return makeSampledInstrument(description, interpolationMode);
+}
@@ -3,7 +3,10 @@
 
 #include <cmath>
 #include "audio_source.h"
+#include <array>
+#include <atomic>
 #include <string>
+#include <thread>
 
 inline double getKeyFrequency(double midiKey)
 {
@@ -29,14 +32,54 @@ inline bool validMidiKey(int key)
     return key >= 0 && key <= maxKey;
 }
 
+/** @brief where a pooled key goes back to once it's retired
+ */
+class MidiKeyFreeList
+{
+public:
+    virtual ~MidiKeyFreeList() = default;
+    virtual void put(std::size_t index) = 0;
+};
+
 class MidiKey : public AudioSource
 {
+    template <typename T>
+    friend class MidiKeyPool;
+    MidiKeyFreeList *freeList = nullptr;
+    std::size_t poolIndex = 0;
+    bool free = false;
 public:
+    /** @brief return the key to the pool it came from
+     *
+     * Called by the channel once it stops playing the key; the key mustn't be played afterwards.
+     * Keys that aren't pooled, and keys retired already, ignore it.
+     */
+    void retire()
+    {
+        if(freeList == nullptr || free)
+            return;
+        free = true;
+        freeList->put(poolIndex);
+    }
     virtual void aftertouch(int aftertouchVelocity) = 0;
     virtual void stop(int velocity = defaultVelocity) = 0;
     virtual void slideTo(int newMidiKey, int velocity) = 0;
     virtual void pitchBend(double semitones) = 0;
+    /** @brief quickly silence a key that is being stolen for a new note
+     *
+     * @param fadeOutTime the time to fade out over
+     *
+     */
+    virtual void fadeOut(double fadeOutTime) = 0;
     virtual bool finished() = 0;
+    virtual bool released() = 0;
+    virtual bool fadingOut() = 0;
+    /** @brief get the current amplitude of the envelope
+     *
+     * @return the current amplitude, including velocity and aftertouch
+     *
+     */
+    virtual float getAmplitude() = 0;
     virtual float getCurrentSample(AudioChannel channel) override = 0;
     virtual void advanceTime(double deltaTime) override = 0;
     virtual std::shared_ptr<AudioSource> duplicate() const override final
@@ -70,6 +113,46 @@ class GenericMidiKey : public MidiKey
         Release
     };
     Stage stage;
+    bool fading;
+    void nextStage()
+    {
+        switch(stage)
+        {
+        case Stage::Attack:
+            stage = Stage::Decay;
+            adsrAmplifier->setAmplitude(decayAmplitude, decaySpeed, AmplifyAudioSource::ScaleType::Linear);
+            break;
+        case Stage::Decay:
+            stage = Stage::Sustain;
+            adsrAmplifier->setAmplitude(0, sustainSpeed, AmplifyAudioSource::ScaleType::Exponential);
+            break;
+        case Stage::Sustain:
+            break;
+        case Stage::Release:
+            break;
+        }
+    }
+    void start(int midiKey, int startVelocity, double pitchBendSemitones)
+    {
+        pitchBendTimeScaler->resetScale(getRelativeKeyFrequency(pitchBendSemitones));
+        timeScaler->resetScale(getRelativeKeyFrequency(midiKey - sourceBaseKey));
+
+        if(attackSpeed <= 0)
+        {
+            adsrAmplifier->resetAmplitude(attackAmplitude);
+            stage = Stage::Decay;
+            adsrAmplifier->setAmplitude(decayAmplitude, decaySpeed, AmplifyAudioSource::ScaleType::Linear);
+        }
+        else
+        {
+            adsrAmplifier->resetAmplitude(0);
+            stage = Stage::Attack;
+            adsrAmplifier->setAmplitude(attackAmplitude, attackSpeed, AmplifyAudioSource::ScaleType::Linear);
+        }
+
+        velocityAmplifier->resetAmplitude((float)startVelocity / defaultVelocity);
+        fading = false;
+    }
 public:
     static constexpr double InstantaneousAttack = -1;
     /** @brief construct a generic midi key
@@ -95,27 +178,44 @@ public:
                    double pitchBendSemitones, std::shared_ptr<AudioSource> source, double sourceBaseKey,
                    double attackSpeed, double decaySpeed, double sustainSpeed, double releaseSpeed, double releaseSpeedVariance,
                    double slideSpeed, double aftertouchSpeed, float attackAmplitude, float decayAmplitude)
-        : sourceBaseKey(sourceBaseKey),
+        : source(source), sourceBaseKey(sourceBaseKey),
           attackSpeed(attackSpeed), decaySpeed(decaySpeed), sustainSpeed(sustainSpeed), releaseSpeed(releaseSpeed),
           releaseSpeedVariance(releaseSpeedVariance), slideSpeed(slideSpeed), aftertouchSpeed(aftertouchSpeed),
-          attackAmplitude(attackAmplitude), decayAmplitude(decayAmplitude), stage(Stage::Attack)
+          attackAmplitude(attackAmplitude), decayAmplitude(decayAmplitude), stage(Stage::Attack), fading(false)
     {
-        pitchBendTimeScaler = std::make_shared<TimeScaleAudioSource>(source, getRelativeKeyFrequency(pitchBendSemitones));
-        timeScaler = std::make_shared<TimeScaleAudioSource>(pitchBendTimeScaler, getRelativeKeyFrequency(midiKey - sourceBaseKey));
-
-        if(attackSpeed <= 0)
-        {
-            adsrAmplifier = std::make_shared<AmplifyAudioSource>(timeScaler, attackAmplitude);
-            stage = Stage::Decay;
-            adsrAmplifier->setAmplitude(decayAmplitude, decaySpeed, AmplifyAudioSource::ScaleType::Linear);
-        }
-        else
-        {
-            adsrAmplifier = std::make_shared<AmplifyAudioSource>(timeScaler, 0);
-            adsrAmplifier->setAmplitude(attackAmplitude, attackSpeed, AmplifyAudioSource::ScaleType::Linear);
-        }
-
-        velocityAmplifier = std::make_shared<AmplifyAudioSource>(adsrAmplifier, (float)startVelocity / defaultVelocity);
+        pitchBendTimeScaler = std::make_shared<TimeScaleAudioSource>(std::move(source));
+        timeScaler = std::make_shared<TimeScaleAudioSource>(pitchBendTimeScaler);
+        adsrAmplifier = std::make_shared<AmplifyAudioSource>(timeScaler);
+        velocityAmplifier = std::make_shared<AmplifyAudioSource>(adsrAmplifier);
+        start(midiKey, startVelocity, pitchBendSemitones);
+    }
+    /** @brief restart a generic midi key for a new note without allocating
+     *
+     * @param midiKey the midi key to play
+     * @param startVelocity the velocity of the note on command
+     * @param pitchBendSemitones the current pitch bend in semitones
+     * @param source the source this key's underlying AudioSource was duplicated from
+     * @return true if the key was restarted; false if the underlying AudioSource can't be assigned
+     *
+     */
+    bool restart(int midiKey, int startVelocity, double pitchBendSemitones, const AudioSource &source)
+    {
+        if(!this->source->assign(source))
+            return false;
+        start(midiKey, startVelocity, pitchBendSemitones);
+        return true;
+    }
+    /** @brief set how often the envelope, slides and pitch bends are updated while rendering
+     *
+     * @param controlInterval the frames between updates; 1 updates every frame
+     *
+     */
+    void setControlInterval(std::size_t controlInterval)
+    {
+        pitchBendTimeScaler->setControlInterval(controlInterval);
+        timeScaler->setControlInterval(controlInterval);
+        adsrAmplifier->setControlInterval(controlInterval);
+        velocityAmplifier->setControlInterval(controlInterval);
     }
     virtual void aftertouch(int aftertouchVelocity) override
     {
@@ -139,14 +239,51 @@ public:
     {
         pitchBendTimeScaler->setScale(getRelativeKeyFrequency(semitones), pitchBendSpeed, TimeScaleAudioSource::ScaleType::Exponential);
     }
+    virtual void fadeOut(double fadeOutTime) override
+    {
+        stage = Stage::Release;
+        fading = true;
+        double amplitude = adsrAmplifier->getAmplitude();
+        if(fadeOutTime <= 0 || amplitude <= 0)
+            adsrAmplifier->resetAmplitude(0);
+        else
+            adsrAmplifier->setAmplitude(0, amplitude / fadeOutTime, AmplifyAudioSource::ScaleType::Linear);
+    }
     virtual bool finished() override
     {
         return stage == Stage::Release && adsrAmplifier->getStabilizeTime() == 0;
     }
+    virtual bool released() override
+    {
+        return stage == Stage::Release;
+    }
+    virtual bool fadingOut() override
+    {
+        return fading;
+    }
+    virtual float getAmplitude() override
+    {
+        return adsrAmplifier->getAmplitude() * velocityAmplifier->getAmplitude();
+    }
+    virtual float getPeakBound() override
+    {
+        // the amplifiers only bound the current stage; a decay can rise above the attack
+        if(stage == Stage::Attack && decayAmplitude > attackAmplitude)
+            return INFINITY;
+        float retval = velocityAmplifier->getPeakBound();
+        // until release, aftertouch can raise the velocity gain as far as maxVelocity / defaultVelocity
+        if(aftertouchSpeed != 0 && stage != Stage::Release)
+            retval = std::max(retval, adsrAmplifier->getPeakBound() * ((float)maxVelocity / defaultVelocity));
+        return retval;
+    }
     virtual float getCurrentSample(AudioChannel channel) override
     {
         return velocityAmplifier->getCurrentSample(channel);
     }
+    virtual void releaseResources() override
+    {
+        velocityAmplifier->releaseResources();
+    }
     virtual void advanceTime(double deltaTime) override
     {
         while(deltaTime > 0)
@@ -161,21 +298,7 @@ public:
                 }
                 else
                     stabilizeTime = 0;
-                switch(stage)
-                {
-                case Stage::Attack:
-                    stage = Stage::Decay;
-                    adsrAmplifier->setAmplitude(decayAmplitude, decaySpeed, AmplifyAudioSource::ScaleType::Linear);
-                    break;
-                case Stage::Decay:
-                    stage = Stage::Sustain;
-                    adsrAmplifier->setAmplitude(0, sustainSpeed, AmplifyAudioSource::ScaleType::Exponential);
-                    break;
-                case Stage::Sustain:
-                    break;
-                case Stage::Release:
-                    break;
-                }
+                nextStage();
                 if(stabilizeTime == 0)
                 {
                     velocityAmplifier->advanceTime(deltaTime);
@@ -189,6 +312,35 @@ public:
             }
         }
     }
+    virtual bool render(float *output, std::size_t frameCount, double frameDuration) override
+    {
+        bool audible = false;
+        while(frameCount > 0)
+        {
+            double stabilizeTime = adsrAmplifier->getStabilizeTime();
+            if(stabilizeTime <= 1e-10 && (stage == Stage::Attack || stage == Stage::Decay))
+            {
+                nextStage();
+                continue;
+            }
+            // render the frames before the next stage transition as one block
+            std::size_t blockFrameCount = frameCount;
+            if(stabilizeTime > 1e-10 && stabilizeTime < frameCount * frameDuration)
+                blockFrameCount = (std::size_t)(stabilizeTime / frameDuration);
+            if(blockFrameCount == 0)
+            {
+                // the frame containing the transition splits its time step
+                MidiKey::render(output, 1, frameDuration);
+                blockFrameCount = 1;
+                audible = true;
+            }
+            else if(velocityAmplifier->render(output, blockFrameCount, frameDuration))
+                audible = true;
+            output += blockFrameCount * audioChannelCount;
+            frameCount -= blockFrameCount;
+        }
+        return audible;
+    }
 };
 
 class SilenceMidiKey : public MidiKey
@@ -196,6 +348,10 @@ class SilenceMidiKey : public MidiKey
 private:
     bool stopped = false;
 public:
+    void restart()
+    {
+        stopped = false;
+    }
     virtual void aftertouch(int aftertouchVelocity) override
     {
     }
@@ -209,10 +365,30 @@ public:
     virtual void pitchBend(double semitones) override
     {
     }
+    virtual void fadeOut(double fadeOutTime) override
+    {
+        stopped = true;
+    }
     virtual bool finished() override
     {
         return stopped;
     }
+    virtual bool released() override
+    {
+        return stopped;
+    }
+    virtual bool fadingOut() override
+    {
+        return false;
+    }
+    virtual float getAmplitude() override
+    {
+        return 0;
+    }
+    virtual float getPeakBound() override
+    {
+        return 0;
+    }
     virtual float getCurrentSample(AudioChannel channel) override
     {
         return 0;
@@ -220,6 +396,79 @@ public:
     virtual void advanceTime(double deltaTime) override
     {
     }
+    virtual bool render(float *output, std::size_t frameCount, double frameDuration) override
+    {
+        std::fill_n(output, frameCount * audioChannelCount, 0.0f);
+        return false;
+    }
+};
+
+/** @brief a fixed set of keys allocated up front and reused for later notes
+ *
+ * Keys are handed out from a free list and go back on it when MidiKey::retire is called, so getting a key never allocates.
+ * Channels sharing an instrument render in parallel, so keys can be retired on several threads at once,
+ * but not while a key is being got. A key still playing when the pool is destroyed just isn't pooled any more.
+ */
+template <typename T>
+class MidiKeyPool final : public MidiKeyFreeList
+{
+    std::vector<std::shared_ptr<T>> keys;
+    /** the indices of the free keys are the first freeCount elements */
+    std::vector<std::size_t> freeIndices;
+    std::atomic<std::size_t> freeCount;
+public:
+    MidiKeyPool()
+        : freeCount(0)
+    {
+    }
+    MidiKeyPool(const MidiKeyPool &) = delete;
+    const MidiKeyPool &operator =(const MidiKeyPool &) = delete;
+    virtual ~MidiKeyPool()
+    {
+        for(const std::shared_ptr<T> &key : keys)
+            static_cast<MidiKey &>(*key).freeList = nullptr;
+    }
+    /** @brief add a free key to the pool
+     *
+     * Allocates, so add every key before notes are played.
+     *
+     * @param key the key to add
+     *
+     */
+    void add(std::shared_ptr<T> key)
+    {
+        MidiKey &midiKey = *key;
+        midiKey.freeList = this;
+        midiKey.poolIndex = keys.size();
+        midiKey.free = true;
+        freeIndices.resize(keys.size() + 1);
+        freeIndices[freeCount.fetch_add(1, std::memory_order_relaxed)] = keys.size();
+        keys.push_back(std::move(key));
+    }
+    /** @brief get a free key
+     *
+     * @return the free key or nullptr if every key is playing
+     *
+     */
+    std::shared_ptr<T> get()
+    {
+        std::size_t count = freeCount.load(std::memory_order_acquire);
+        if(count == 0)
+            return nullptr;
+        freeCount.store(count - 1, std::memory_order_relaxed);
+        const std::shared_ptr<T> &key = keys[freeIndices[count - 1]];
+        static_cast<MidiKey &>(*key).free = false;
+        return key;
+    }
+    virtual void put(std::size_t index) override
+    {
+        // a key is only put back once per get, so this stays within the indices add made room for
+        freeIndices[freeCount.fetch_add(1, std::memory_order_acq_rel)] = index;
+    }
+    std::size_t size() const
+    {
+        return keys.size();
+    }
 };
 
 class MidiInstrument
@@ -252,7 +501,7 @@ public:
      * @param midiKey the midi key to play
      * @param startVelocity the velocity of the note on command
      * @param pitchBendSemitones the current pitch bend in semitones
-     * @return the new MidiKey
+     * @return the new MidiKey or nullptr if every key the instrument can play at once is playing
      *
      */
     virtual std::shared_ptr<MidiKey> generate(int midiKey, int startVelocity, double pitchBendSemitones) const = 0;
@@ -278,7 +527,11 @@ class GenericMidiInstrument : public MidiInstrument
     double aftertouchSpeed;
     float attackAmplitude;
     float decayAmplitude;
+    std::size_t controlInterval;
+    mutable MidiKeyPool<GenericMidiKey> keyPool;
 public:
+    /** enough for every key of a range to ring on with the sustain pedal down */
+    static constexpr std::size_t defaultVoicePoolSize = 32;
     /** @brief construct a generic midi instrument
      *
      * @param name the instrument name
@@ -294,25 +547,40 @@ public:
      * @param aftertouchSpeed the speed of aftertouching
      * @param attackAmplitude the amplitude of the attack
      * @param decayAmplitude the amplitude of the initial decay
+     * @param voicePoolSize the most keys playing at once; they're allocated up front and reused for later notes
+     * @param controlInterval the frames between updates of the envelope, slides and pitch bends
+     * @throw std::runtime_error if source can't be assigned to its duplicates, so keys couldn't be reused
      *
      */
     GenericMidiInstrument(std::string name, std::shared_ptr<AudioSource> source, double sourceBaseKey,
                    double attackSpeed, double decaySpeed, double sustainSpeed, double releaseSpeed, double releaseSpeedVariance,
-                   double slideSpeed, double aftertouchSpeed, float attackAmplitude, float decayAmplitude)
-        : MidiInstrument(std::move(name)), source(std::move(source)), sourceBaseKey(sourceBaseKey), attackSpeed(attackSpeed), decaySpeed(decaySpeed), sustainSpeed(sustainSpeed), releaseSpeed(releaseSpeed), releaseSpeedVariance(releaseSpeedVariance), slideSpeed(slideSpeed), aftertouchSpeed(aftertouchSpeed), attackAmplitude(attackAmplitude), decayAmplitude(decayAmplitude)
+                   double slideSpeed, double aftertouchSpeed, float attackAmplitude, float decayAmplitude, std::size_t voicePoolSize = defaultVoicePoolSize,
+                   std::size_t controlInterval = AmplifyAudioSource::defaultControlInterval)
+        : MidiInstrument(std::move(name)), source(std::move(source)), sourceBaseKey(sourceBaseKey), attackSpeed(attackSpeed), decaySpeed(decaySpeed), sustainSpeed(sustainSpeed), releaseSpeed(releaseSpeed), releaseSpeedVariance(releaseSpeedVariance), slideSpeed(slideSpeed), aftertouchSpeed(aftertouchSpeed), attackAmplitude(attackAmplitude), decayAmplitude(decayAmplitude), controlInterval(controlInterval)
     {
+        for(std::size_t i = 0; i < voicePoolSize; i++)
+        {
+            std::shared_ptr<GenericMidiKey> key = makeKey(middleC, defaultVelocity, 0);
+            if(!key->restart(middleC, defaultVelocity, 0, *this->source))
+                throw std::runtime_error("can't reuse the keys of instrument " + getName());
+            keyPool.add(std::move(key));
+        }
     }
     /** @brief generate a MidiKey
      *
      * @param midiKey the midi key to play
      * @param startVelocity the velocity of the note on command
      * @param pitchBendSemitones the current pitch bend in semitones
-     * @return the new MidiKey
+     * @return the new MidiKey or nullptr if every key in the pool is playing
      *
      */
     virtual std::shared_ptr<MidiKey> generate(int midiKey, int startVelocity, double pitchBendSemitones) const override
     {
-        return std::make_shared<GenericMidiKey>(midiKey, startVelocity, pitchBendSemitones, source->duplicate(), sourceBaseKey, attackSpeed, decaySpeed, sustainSpeed, releaseSpeed, releaseSpeedVariance, slideSpeed, aftertouchSpeed, attackAmplitude, decayAmplitude);
+        // the constructor checked that keys restart, so note on never allocates
+        std::shared_ptr<GenericMidiKey> key = keyPool.get();
+        if(key != nullptr)
+            key->restart(midiKey, startVelocity, pitchBendSemitones, *source);
+        return key;
     }
     /** @brief check if a key supports sliding
      *
@@ -324,6 +592,13 @@ public:
     {
         return slideSpeed > 0;
     }
+private:
+    std::shared_ptr<GenericMidiKey> makeKey(int midiKey, int startVelocity, double pitchBendSemitones) const
+    {
+        std::shared_ptr<GenericMidiKey> retval = std::make_shared<GenericMidiKey>(midiKey, startVelocity, pitchBendSemitones, source->duplicate(), sourceBaseKey, attackSpeed, decaySpeed, sustainSpeed, releaseSpeed, releaseSpeedVariance, slideSpeed, aftertouchSpeed, attackAmplitude, decayAmplitude);
+        retval->setControlInterval(controlInterval);
+        return retval;
+    }
 };
 
 class SelectMidiInstrument : public MidiInstrument
@@ -355,51 +630,112 @@ public:
         }
     };
 private:
+    typedef std::array<const MidiInstrument *, maxKey + 1> KeyTable;
     std::vector<Range> ranges;
-    std::shared_ptr<MidiInstrument> getInstrument(int key) const
+    /** the instrument of every midi key, read by the audio threads without locking */
+    std::atomic<const KeyTable *> keyTable;
+    /** the threads reading keyTable; a replaced table is freed once none of them can still be reading it */
+    mutable std::atomic<std::size_t> keyTableReaderCount;
+    mutable MidiKeyPool<SilenceMidiKey> silenceKeyPool;
+    const MidiInstrument *findInstrument(int key) const
     {
         if(ranges.empty())
             return nullptr;
         int minDistance = ranges[0].distance(key);
         if(minDistance <= 0)
-            return ranges[0].instrument;
+            return ranges[0].instrument.get();
         int minDistanceIndex = 0;
         for(size_t i = 1; i < ranges.size(); i++)
         {
             int d = ranges[i].distance(key);
             if(d <= 0)
-                return ranges[i].instrument;
+                return ranges[i].instrument.get();
             if(d < minDistance)
             {
                 minDistance = d;
                 minDistanceIndex = i;
             }
         }
-        return ranges[minDistanceIndex].instrument;
+        return ranges[minDistanceIndex].instrument.get();
+    }
+    const MidiInstrument *getInstrument(int key) const
+    {
+        // ranges can be added meanwhile, so keys out of range play the nearest key's instrument from the table too
+        key = std::min(std::max(key, 0), maxKey);
+        keyTableReaderCount.fetch_add(1);
+        const MidiInstrument *retval = (*keyTable.load())[key];
+        keyTableReaderCount.fetch_sub(1);
+        return retval;
+    }
+    void updateKeyTable()
+    {
+        KeyTable *newKeyTable = new KeyTable;
+        for(int key = 0; key <= maxKey; key++)
+            (*newKeyTable)[key] = findInstrument(key);
+        std::unique_ptr<const KeyTable> oldKeyTable(keyTable.exchange(newKeyTable));
+        // a reader counts itself before getting the table, so one that got the old table is done once the count is seen at 0
+        while(keyTableReaderCount.load() != 0)
+            std::this_thread::yield();
     }
 public:
     SelectMidiInstrument(std::string name)
-        : MidiInstrument(std::move(name))
+        : MidiInstrument(std::move(name)), keyTable(nullptr), keyTableReaderCount(0)
     {
+        for(std::size_t i = 0; i < GenericMidiInstrument::defaultVoicePoolSize; i++)
+            silenceKeyPool.add(std::make_shared<SilenceMidiKey>());
+        updateKeyTable();
     }
+    virtual ~SelectMidiInstrument()
+    {
+        delete keyTable.load();
+    }
+    /** @brief add a range of keys
+     *
+     * The key table is rebuilt and swapped in atomically, so keys can be generated on the audio thread meanwhile.
+     * The replaced table is freed once the audio thread can't be reading it; use addRanges to add many ranges at once.
+     *
+     * @param range the range to add; ranges without an instrument or keys are ignored
+     *
+     */
     void addRange(Range range)
     {
-        if(range.good())
-            ranges.push_back(std::move(range));
+        if(!range.good())
+            return;
+        ranges.push_back(std::move(range));
+        updateKeyTable();
+    }
+    /** @brief add ranges of keys, rebuilding the key table once
+     *
+     * @param newRanges the ranges to add; ranges without an instrument or keys are ignored
+     *
+     */
+    void addRanges(std::vector<Range> newRanges)
+    {
+        for(Range &range : newRanges)
+        {
+            if(range.good())
+                ranges.push_back(std::move(range));
+        }
+        updateKeyTable();
     }
     /** @brief generate a MidiKey
      *
      * @param midiKey the midi key to play
      * @param startVelocity the velocity of the note on command
      * @param pitchBendSemitones the current pitch bend in semitones
-     * @return the new MidiKey
+     * @return the new MidiKey or nullptr if every key the instrument can play at once is playing
      *
      */
     virtual std::shared_ptr<MidiKey> generate(int midiKey, int startVelocity, double pitchBendSemitones) const override
     {
-        std::shared_ptr<MidiInstrument> instrument = getInstrument(midiKey);
+        const MidiInstrument *instrument = getInstrument(midiKey);
         if(instrument == nullptr)
-            return std::make_shared<SilenceMidiKey>();
+        {
+            std::shared_ptr<SilenceMidiKey> key = silenceKeyPool.get();
+            if(key != nullptr)
+                key->restart();
+            return key;
+        }
         return instrument->generate(midiKey, startVelocity, pitchBendSemitones);
     }
     /** @brief check if a key supports sliding
@@ -410,13 +746,98 @@ public:
      */
     virtual bool supportsSlide(int midiKey) const
     {
-        std::shared_ptr<MidiInstrument> instrument = getInstrument(midiKey);
+        const MidiInstrument *instrument = getInstrument(midiKey);
         if(instrument == nullptr)
             return true;
         return instrument->supportsSlide(midiKey);
     }
 };
 
-std::shared_ptr<MidiInstrument> loadFromDirectory(std::string path);
+/** @brief the parameters of a sampled instrument as described by its keys.txt
+ */
+struct SampledInstrumentDescription
+{
+    struct AudioFile
+    {
+        std::string path;
+        array_AudioChannel<float> channelAmplitudes;
+        std::shared_ptr<AudioData> audioData;
+    };
+    struct Key
+    {
+        double sourceBaseKey;
+        double attackSpeed;
+        double decaySpeed;
+        double sustainSpeed;
+        double releaseSpeed;
+        double releaseSpeedVariance;
+        double slideSpeed;
+        double aftertouchSpeed;
+        float attackAmplitude;
+        float decayAmplitude;
+        size_t loopStart, loopEnd;
+        double loopDecayAmplitude;
+        int startKey, endKey;
+        std::vector<AudioFile> audioFiles;
+    };
+    std::string name;
+    std::vector<Key> keys;
+};
+
+/** @brief parse the keys.txt of an instrument directory without loading any audio
+ *
+ * @param path the instrument directory
+ * @return the instrument description with every AudioFile::audioData set to nullptr
+ *
+ */
+SampledInstrumentDescription parseInstrumentDirectory(std::string path);
+
+/** @brief load an audio file of an instrument and apply its key's loop
+ *
+ * Loads through AudioDataCache::getDefault(), so the returned audio data may be shared and must not be modified.
+ *
+ * @param key the key the audio file belongs to
+ * @param audioFile the audio file to load
+ * @param sampleFormat the format to store the samples as
+ * @param mipLevelCount the most band limited half rate levels to build for playing far above the original pitch
+ * @return the loaded audio data
+ *
+ */
+std::shared_ptr<AudioData> loadInstrumentAudio(const SampledInstrumentDescription::Key &key, const SampledInstrumentDescription::AudioFile &audioFile, AudioData::SampleFormat sampleFormat = AudioData::SampleFormat::Float32, std::size_t mipLevelCount = 0);
+
+/** @brief load every audio file of an instrument
+ *
+ * The audio files are decoded concurrently. If any fail to load, the error
+ * of the first failing file in description order is thrown, including how long it took.
+ *
+ * @param description the instrument description to set every AudioFile::audioData of
+ * @param threadCount the number of loading threads or 0 for one per hardware thread
+ * @param sampleFormat the format to store the samples as
+ * @param mipLevelCount the most band limited half rate levels to build for each audio file
+ *
+ */
+void loadInstrumentAudio(SampledInstrumentDescription &description, unsigned threadCount = 0, AudioData::SampleFormat sampleFormat = AudioData::SampleFormat::Float32, std::size_t mipLevelCount = 0);
+
+/** @brief build an instrument from a description
+ *
+ * @param description the instrument description with every AudioFile::audioData loaded
+ * @param interpolationMode how the instrument's samples are resampled
+ * @param voicePoolSize the most notes each key range can play at once
+ * @return the new instrument
+ *
+ */
+std::shared_ptr<MidiInstrument> makeSampledInstrument(const SampledInstrumentDescription &description, InterpolationMode interpolationMode = InterpolationMode::Default, std::size_t voicePoolSize = GenericMidiInstrument::defaultVoicePoolSize);
+
+/** @brief load an instrument from an instrument directory
+ *
+ * @param path the instrument directory
+ * @param threadCount the number of threads to decode with or 0 for one per hardware thread
+ * @param sampleFormat the format to store the samples as; the integer formats take a half or three quarters of the memory
+ * @param interpolationMode how the instrument's samples are resampled
+ * @param mipLevelCount the most band limited half rate levels to build for each audio file
+ * @return the new instrument
+ *
+ */
+std::shared_ptr<MidiInstrument> loadFromDirectory(std::string path, unsigned threadCount = 0, AudioData::SampleFormat sampleFormat = AudioData::SampleFormat::Float32, InterpolationMode interpolationMode = InterpolationMode::Default, std::size_t mipLevelCount = 0);
 
 #endif // MIDI_KEY_H_INCLUDED
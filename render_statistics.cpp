@@ -0,0 +1,281 @@
+#include "render_statistics.h"
+#include "audio_data.h"
+#include "audio_data_cache.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+void addDouble(atomic<double> &value, double amount)
+{
+    double expected = value.load(memory_order_relaxed);
+    while(!value.compare_exchange_weak(expected, expected + amount, memory_order_relaxed))
+    {
+    }
+}
+
+void maxDouble(atomic<double> &value, double newValue)
+{
+    double expected = value.load(memory_order_relaxed);
+    while(expected < newValue && !value.compare_exchange_weak(expected, newValue, memory_order_relaxed))
+    {
+    }
+}
+
+bool writeAll(int fd, const string &text, bool isSocket)
+{
+    const char *data = text.data();
+    size_t length = text.size();
+    while(length > 0)
+    {
+        // a client hanging up mustn't raise SIGPIPE
+        ssize_t writeCount = isSocket ? send(fd, data, length, MSG_NOSIGNAL) : write(fd, data, length);
+        if(writeCount < 0 && errno == EINTR)
+            continue;
+        if(writeCount <= 0)
+            return false;
+        data += writeCount;
+        length -= writeCount;
+    }
+    return true;
+}
+}
+
+constexpr std::size_t RenderStatistics::defaultChannelCount;
+constexpr std::size_t RenderStatistics::loadBucketCount;
+const std::array<double, RenderStatistics::loadBucketCount> RenderStatistics::loadBucketUpperBounds =
+{
+    0.1, 0.25, 0.5, 0.75, 0.9, 1, 1.5, 2, 4
+};
+
+RenderStatistics::RenderStatistics(std::size_t channelCount)
+    : callbackCount(0), xrunCount(0), lockWaitCount(0), underrunCount(0), callbackDeadline(0), maxCallbackDuration(0),
+      loadSum(0), voicesStarted(0), voicesStolen(0), voicesRetired(0), voicesDropped(0), eventQueueDepth(0)
+{
+    for(atomic<uint64_t> &count : loadBucketCounts)
+        count.store(0, memory_order_relaxed);
+    for(size_t i = 0; i < channelCount; i++)
+        activeVoiceCounts.push_back(unique_ptr<atomic<size_t>>(new atomic<size_t>(0)));
+}
+
+void RenderStatistics::recordCallback(double duration, double deadline)
+{
+    callbackCount.fetch_add(1, memory_order_relaxed);
+    callbackDeadline.store(deadline, memory_order_relaxed);
+    maxDouble(maxCallbackDuration, duration);
+    if(duration > deadline)
+        xrunCount.fetch_add(1, memory_order_relaxed);
+    if(deadline <= 0)
+        return;
+    double load = duration / deadline;
+    addDouble(loadSum, load);
+    size_t bucket = lower_bound(loadBucketUpperBounds.begin(), loadBucketUpperBounds.end(), load) - loadBucketUpperBounds.begin();
+    if(bucket < loadBucketCount)
+        loadBucketCounts[bucket].fetch_add(1, memory_order_relaxed);
+}
+
+RenderStatistics::Snapshot RenderStatistics::getSnapshot() const
+{
+    Snapshot retval;
+    retval.callbackCount = callbackCount.load(memory_order_relaxed);
+    retval.xrunCount = xrunCount.load(memory_order_relaxed);
+    retval.lockWaitCount = lockWaitCount.load(memory_order_relaxed);
+    retval.underrunCount = underrunCount.load(memory_order_relaxed);
+    retval.callbackDeadline = callbackDeadline.load(memory_order_relaxed);
+    retval.maxCallbackDuration = maxCallbackDuration.load(memory_order_relaxed);
+    uint64_t cumulativeCount = 0;
+    for(size_t i = 0; i < loadBucketCount; i++)
+    {
+        cumulativeCount += loadBucketCounts[i].load(memory_order_relaxed);
+        retval.loadBucketCounts[i] = cumulativeCount;
+    }
+    retval.loadSum = loadSum.load(memory_order_relaxed);
+    for(const unique_ptr<atomic<size_t>> &count : activeVoiceCounts)
+        retval.activeVoiceCounts.push_back(count->load(memory_order_relaxed));
+    retval.voicesStarted = voicesStarted.load(memory_order_relaxed);
+    retval.voicesStolen = voicesStolen.load(memory_order_relaxed);
+    retval.voicesRetired = voicesRetired.load(memory_order_relaxed);
+    retval.voicesDropped = voicesDropped.load(memory_order_relaxed);
+    retval.eventQueueDepth = eventQueueDepth.load(memory_order_relaxed);
+    retval.sampleMemorySize = getAudioDataMemorySize();
+    AudioDataCache::Statistics cacheStatistics = AudioDataCache::getDefault().getStatistics();
+    retval.sampleCacheHitCount = cacheStatistics.hitCount;
+    retval.sampleCacheMissCount = cacheStatistics.missCount;
+    retval.sampleCacheEvictionCount = cacheStatistics.evictionCount;
+    retval.sampleCacheMemorySize = cacheStatistics.memorySize;
+    return retval;
+}
+
+std::string RenderStatistics::formatPrometheus(const Snapshot &snapshot)
+{
+    ostringstream os;
+    os.precision(9);
+    os << "# HELP synth_callbacks_total Audio callbacks rendered.\n"
+       << "# TYPE synth_callbacks_total counter\n"
+       << "synth_callbacks_total " << snapshot.callbackCount << "\n"
+       << "# HELP synth_xruns_total Audio callbacks that took longer than their deadline.\n"
+       << "# TYPE synth_xruns_total counter\n"
+       << "synth_xruns_total " << snapshot.xrunCount << "\n"
+       << "# HELP synth_lock_waits_total Blocks that had to wait for a control thread holding the source lock.\n"
+       << "# TYPE synth_lock_waits_total counter\n"
+       << "synth_lock_waits_total " << snapshot.lockWaitCount << "\n"
+       << "# HELP synth_underruns_total Device periods partly played as silence because rendering fell behind.\n"
+       << "# TYPE synth_underruns_total counter\n"
+       << "synth_underruns_total " << snapshot.underrunCount << "\n"
+       << "# HELP synth_callback_deadline_seconds The time an audio callback has to render its block.\n"
+       << "# TYPE synth_callback_deadline_seconds gauge\n"
+       << "synth_callback_deadline_seconds " << snapshot.callbackDeadline << "\n"
+       << "# HELP synth_callback_duration_max_seconds The longest audio callback.\n"
+       << "# TYPE synth_callback_duration_max_seconds gauge\n"
+       << "synth_callback_duration_max_seconds " << snapshot.maxCallbackDuration << "\n"
+       << "# HELP synth_callback_load Audio callback duration as a fraction of its deadline.\n"
+       << "# TYPE synth_callback_load histogram\n";
+    for(size_t i = 0; i < loadBucketCount; i++)
+        os << "synth_callback_load_bucket{le=\"" << loadBucketUpperBounds[i] << "\"} " << snapshot.loadBucketCounts[i] << "\n";
+    os << "synth_callback_load_bucket{le=\"+Inf\"} " << snapshot.callbackCount << "\n"
+       << "synth_callback_load_sum " << snapshot.loadSum << "\n"
+       << "synth_callback_load_count " << snapshot.callbackCount << "\n"
+       << "# HELP synth_active_voices Voices playing on each midi channel.\n"
+       << "# TYPE synth_active_voices gauge\n";
+    for(size_t i = 0; i < snapshot.activeVoiceCounts.size(); i++)
+        os << "synth_active_voices{channel=\"" << i << "\"} " << snapshot.activeVoiceCounts[i] << "\n";
+    os << "# HELP synth_voices_started_total Voices started by note on.\n"
+       << "# TYPE synth_voices_started_total counter\n"
+       << "synth_voices_started_total " << snapshot.voicesStarted << "\n"
+       << "# HELP synth_voices_stolen_total Voices stolen to stay within the polyphony limit.\n"
+       << "# TYPE synth_voices_stolen_total counter\n"
+       << "synth_voices_stolen_total " << snapshot.voicesStolen << "\n"
+       << "# HELP synth_voices_retired_total Voices that finished playing.\n"
+       << "# TYPE synth_voices_retired_total counter\n"
+       << "synth_voices_retired_total " << snapshot.voicesRetired << "\n"
+       << "# HELP synth_voices_dropped_total Notes dropped because their instrument had no free voice.\n"
+       << "# TYPE synth_voices_dropped_total counter\n"
+       << "synth_voices_dropped_total " << snapshot.voicesDropped << "\n"
+       << "# HELP synth_event_queue_depth Scheduled events and queued commands waiting to be applied.\n"
+       << "# TYPE synth_event_queue_depth gauge\n"
+       << "synth_event_queue_depth " << snapshot.eventQueueDepth << "\n"
+       << "# HELP synth_sample_memory_bytes Memory holding sample data, including mapped banks.\n"
+       << "# TYPE synth_sample_memory_bytes gauge\n"
+       << "synth_sample_memory_bytes " << snapshot.sampleMemorySize << "\n"
+       << "# HELP synth_sample_cache_hits_total Sample loads served by the decoded sample cache.\n"
+       << "# TYPE synth_sample_cache_hits_total counter\n"
+       << "synth_sample_cache_hits_total " << snapshot.sampleCacheHitCount << "\n"
+       << "# HELP synth_sample_cache_misses_total Sample loads that had to decode.\n"
+       << "# TYPE synth_sample_cache_misses_total counter\n"
+       << "synth_sample_cache_misses_total " << snapshot.sampleCacheMissCount << "\n"
+       << "# HELP synth_sample_cache_evictions_total Unused decoded samples evicted to stay within the memory budget.\n"
+       << "# TYPE synth_sample_cache_evictions_total counter\n"
+       << "synth_sample_cache_evictions_total " << snapshot.sampleCacheEvictionCount << "\n"
+       << "# HELP synth_sample_cache_memory_bytes Memory holding decoded samples in the cache.\n"
+       << "# TYPE synth_sample_cache_memory_bytes gauge\n"
+       << "synth_sample_cache_memory_bytes " << snapshot.sampleCacheMemorySize << "\n";
+    return os.str();
+}
+
+StatisticsExporter::StatisticsExporter(std::shared_ptr<const RenderStatistics> statistics, std::string path, Target target, double interval)
+    : statistics(std::move(statistics)), path(std::move(path)), target(target), interval(interval), listenSocket(-1)
+{
+    if(pipe2(wakePipe, O_CLOEXEC) != 0)
+        throw runtime_error("can't create pipe");
+    if(target == Target::Socket)
+    {
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        listenSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(listenSocket < 0 || this->path.size() >= sizeof(address.sun_path))
+        {
+            if(listenSocket >= 0)
+                close(listenSocket);
+            close(wakePipe[0]);
+            close(wakePipe[1]);
+            throw runtime_error("can't create socket : " + this->path);
+        }
+        strcpy(address.sun_path, this->path.c_str());
+        unlink(this->path.c_str());
+        if(bind(listenSocket, (const sockaddr *)&address, sizeof(address)) != 0 || listen(listenSocket, 4) != 0)
+        {
+            close(listenSocket);
+            close(wakePipe[0]);
+            close(wakePipe[1]);
+            throw runtime_error("can't create socket : " + this->path);
+        }
+    }
+    thread = std::thread([this]()
+    {
+        threadMain();
+    });
+}
+
+StatisticsExporter::~StatisticsExporter()
+{
+    char byte = 0;
+    while(write(wakePipe[1], &byte, 1) < 0 && errno == EINTR)
+    {
+    }
+    thread.join();
+    close(wakePipe[0]);
+    close(wakePipe[1]);
+    if(listenSocket >= 0)
+    {
+        close(listenSocket);
+        unlink(path.c_str());
+    }
+}
+
+void StatisticsExporter::writeFile()
+{
+    // write a new file and rename it over the old one so readers never see a partial file
+    string tempPath = path + ".tmp";
+    int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0)
+        return;
+    bool written = writeAll(fd, RenderStatistics::formatPrometheus(statistics->getSnapshot()), false);
+    close(fd);
+    if(!written || rename(tempPath.c_str(), path.c_str()) != 0)
+        unlink(tempPath.c_str());
+}
+
+void StatisticsExporter::threadMain()
+{
+    int timeout = target == Target::File ? max(1, (int)(interval * 1000)) : -1;
+    if(target == Target::File)
+        writeFile();
+    while(true)
+    {
+        pollfd fds[2];
+        fds[0].fd = wakePipe[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = listenSocket;
+        fds[1].events = POLLIN;
+        int result = poll(fds, listenSocket >= 0 ? 2 : 1, timeout);
+        if(result < 0 && errno == EINTR)
+            continue;
+        if(result < 0 || (fds[0].revents & POLLIN))
+            return;
+        if(result == 0)
+        {
+            writeFile();
+            continue;
+        }
+        if(listenSocket >= 0 && (fds[1].revents & POLLIN))
+        {
+            int connection = accept4(listenSocket, nullptr, nullptr, SOCK_CLOEXEC);
+            if(connection < 0)
+                continue;
+            writeAll(connection, RenderStatistics::formatPrometheus(statistics->getSnapshot()), true);
+            close(connection);
+        }
+    }
+}
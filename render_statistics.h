@@ -0,0 +1,169 @@
+#ifndef RENDER_STATISTICS_H_INCLUDED
+#define RENDER_STATISTICS_H_INCLUDED
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** @brief counters about rendering, updated by the audio thread and read by any thread
+ *
+ * Every update is a relaxed atomic operation, so the audio thread never waits.
+ * A snapshot reads the counters one at a time, so counters updated during the snapshot may disagree slightly.
+ */
+class RenderStatistics
+{
+public:
+    static constexpr std::size_t defaultChannelCount = 16;
+    /** the upper bounds of the callback load histogram buckets, as fractions of the deadline */
+    static constexpr std::size_t loadBucketCount = 9;
+    static const std::array<double, loadBucketCount> loadBucketUpperBounds;
+    struct Snapshot
+    {
+        std::uint64_t callbackCount;
+        /** callbacks that took longer than their deadline */
+        std::uint64_t xrunCount;
+        /** blocks that had to wait for a control thread holding the source lock */
+        std::uint64_t lockWaitCount;
+        /** device periods partly played as silence because rendering fell behind */
+        std::uint64_t underrunCount;
+        /** the deadline of the last callback in seconds */
+        double callbackDeadline;
+        double maxCallbackDuration;
+        /** the number of callbacks at or below each load bucket's upper bound */
+        std::array<std::uint64_t, loadBucketCount> loadBucketCounts;
+        /** the sum of callback duration divided by deadline */
+        double loadSum;
+        std::vector<std::size_t> activeVoiceCounts;
+        std::uint64_t voicesStarted;
+        std::uint64_t voicesStolen;
+        std::uint64_t voicesRetired;
+        /** notes dropped because their instrument had no free voice */
+        std::uint64_t voicesDropped;
+        std::size_t eventQueueDepth;
+        /** the bytes of resident and mapped sample data */
+        std::size_t sampleMemorySize;
+        /** loads of decoded sample data served by the shared cache and loads that had to decode */
+        std::uint64_t sampleCacheHitCount;
+        std::uint64_t sampleCacheMissCount;
+        std::uint64_t sampleCacheEvictionCount;
+        /** the bytes of decoded sample data held by the shared cache */
+        std::size_t sampleCacheMemorySize;
+    };
+private:
+    std::atomic<std::uint64_t> callbackCount;
+    std::atomic<std::uint64_t> xrunCount;
+    std::atomic<std::uint64_t> lockWaitCount;
+    std::atomic<std::uint64_t> underrunCount;
+    std::atomic<double> callbackDeadline;
+    std::atomic<double> maxCallbackDuration;
+    std::array<std::atomic<std::uint64_t>, loadBucketCount> loadBucketCounts;
+    std::atomic<double> loadSum;
+    std::vector<std::unique_ptr<std::atomic<std::size_t>>> activeVoiceCounts;
+    std::atomic<std::uint64_t> voicesStarted;
+    std::atomic<std::uint64_t> voicesStolen;
+    std::atomic<std::uint64_t> voicesRetired;
+    std::atomic<std::uint64_t> voicesDropped;
+    std::atomic<std::size_t> eventQueueDepth;
+public:
+    /** @brief construct render statistics
+     *
+     * @param channelCount the number of midi channels to count active voices for
+     *
+     */
+    explicit RenderStatistics(std::size_t channelCount = defaultChannelCount);
+    RenderStatistics(const RenderStatistics &) = delete;
+    const RenderStatistics &operator =(const RenderStatistics &) = delete;
+    /** @brief record an audio callback
+     *
+     * @param duration the time the callback took in seconds
+     * @param deadline the time the callback had before the device needed its output in seconds
+     *
+     */
+    void recordCallback(double duration, double deadline);
+    void recordLockWait()
+    {
+        lockWaitCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    void recordUnderrun()
+    {
+        underrunCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    void recordVoiceStarted()
+    {
+        voicesStarted.fetch_add(1, std::memory_order_relaxed);
+    }
+    void recordVoiceStolen()
+    {
+        voicesStolen.fetch_add(1, std::memory_order_relaxed);
+    }
+    void recordVoiceRetired()
+    {
+        voicesRetired.fetch_add(1, std::memory_order_relaxed);
+    }
+    void recordVoiceDropped()
+    {
+        voicesDropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    /** @brief set the number of voices playing on a channel
+     *
+     * Channels out of range are ignored.
+     */
+    void setActiveVoiceCount(std::size_t channelIndex, std::size_t voiceCount)
+    {
+        if(channelIndex < activeVoiceCounts.size())
+            activeVoiceCounts[channelIndex]->store(voiceCount, std::memory_order_relaxed);
+    }
+    void setEventQueueDepth(std::size_t depth)
+    {
+        eventQueueDepth.store(depth, std::memory_order_relaxed);
+    }
+    Snapshot getSnapshot() const;
+    /** @brief format a snapshot in the Prometheus text exposition format
+     */
+    static std::string formatPrometheus(const Snapshot &snapshot);
+};
+
+/** @brief periodically publishes render statistics for Prometheus
+ *
+ * In file mode the file is replaced with the current statistics every interval, which suits a textfile collector.
+ * In socket mode a unix domain socket is listened on and every connection is sent the current statistics and closed.
+ */
+class StatisticsExporter
+{
+public:
+    enum class Target
+    {
+        File,
+        Socket,
+    };
+private:
+    std::shared_ptr<const RenderStatistics> statistics;
+    std::string path;
+    Target target;
+    double interval;
+    int listenSocket;
+    int wakePipe[2];
+    std::thread thread;
+    void threadMain();
+    void writeFile();
+public:
+    /** @brief start exporting statistics
+     *
+     * @param statistics the statistics to export
+     * @param path the file or socket path
+     * @param target whether to write a file or listen on a socket
+     * @param interval the time between file updates in seconds
+     * @throw std::runtime_error if the socket can't be created
+     *
+     */
+    StatisticsExporter(std::shared_ptr<const RenderStatistics> statistics, std::string path, Target target = Target::File, double interval = 1);
+    StatisticsExporter(const StatisticsExporter &) = delete;
+    const StatisticsExporter &operator =(const StatisticsExporter &) = delete;
+    ~StatisticsExporter();
+};
+
+#endif // RENDER_STATISTICS_H_INCLUDED
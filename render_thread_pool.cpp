@@ -0,0 +1,153 @@
+#include "render_thread_pool.h"
+#include <pthread.h>
+#include <sched.h>
+
+using namespace std;
+
+namespace
+{
+thread_local bool inTask = false;
+constexpr unsigned defaultSpinCount = 2000;
+
+void setRealtimePriority()
+{
+    // best effort: without permission the workers stay at normal priority
+    sched_param param;
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+}
+}
+
+RenderThreadPool::RenderThreadPool(unsigned threadCount)
+    : generation(0), spinCount(defaultSpinCount), done(false), remainingTaskCount(0), task(nullptr), context(nullptr)
+{
+    unsigned hardwareThreadCount = thread::hardware_concurrency();
+    if(threadCount == 0)
+        threadCount = hardwareThreadCount;
+    if(threadCount == 0)
+        threadCount = 1;
+    // spinning workers would take the cores the thread calling run needs
+    if(threadCount > hardwareThreadCount)
+        spinCount = 0;
+    for(unsigned i = 0; i < threadCount; i++)
+        workers.push_back(unique_ptr<Worker>(new Worker));
+    // worker 0 is the thread calling run
+    for(size_t i = 1; i < workers.size(); i++)
+    {
+        workers[i]->thread = std::thread([this, i]()
+        {
+            workerMain(i);
+        });
+    }
+}
+
+RenderThreadPool::~RenderThreadPool()
+{
+    {
+        lock_guard<mutex> lock(wakeLock);
+        done = true;
+    }
+    wakeCondition.notify_all();
+    for(size_t i = 1; i < workers.size(); i++)
+        workers[i]->thread.join();
+}
+
+bool RenderThreadPool::takeTask(Worker &worker, bool fromBack, std::size_t &taskIndex)
+{
+    uint64_t range = worker.range.load(memory_order_acquire);
+    while(true)
+    {
+        uint32_t begin = range >> 32, end = (uint32_t)range;
+        if(begin >= end)
+            return false;
+        uint64_t newRange;
+        if(fromBack)
+        {
+            taskIndex = end - 1;
+            newRange = ((uint64_t)begin << 32) | (end - 1);
+        }
+        else
+        {
+            taskIndex = begin;
+            newRange = ((uint64_t)(begin + 1) << 32) | end;
+        }
+        if(worker.range.compare_exchange_weak(range, newRange, memory_order_acq_rel, memory_order_acquire))
+            return true;
+    }
+}
+
+void RenderThreadPool::work(std::size_t workerIndex)
+{
+    size_t taskIndex;
+    while(true)
+    {
+        bool found = takeTask(*workers[workerIndex], false, taskIndex);
+        for(size_t i = 1; !found && i < workers.size(); i++)
+            found = takeTask(*workers[(workerIndex + i) % workers.size()], true, taskIndex);
+        if(!found)
+            return;
+        inTask = true;
+        task.load(memory_order_relaxed)(context.load(memory_order_relaxed), taskIndex);
+        inTask = false;
+        remainingTaskCount.fetch_sub(1, memory_order_acq_rel);
+    }
+}
+
+void RenderThreadPool::workerMain(std::size_t workerIndex)
+{
+    setRealtimePriority();
+    uint64_t lastGeneration = 0;
+    while(true)
+    {
+        // the next block usually follows soon, so watch for it for a while before sleeping
+        uint64_t currentGeneration = generation.load(memory_order_acquire);
+        for(unsigned i = 0; i < spinCount && currentGeneration == lastGeneration; i++)
+        {
+            this_thread::yield();
+            currentGeneration = generation.load(memory_order_acquire);
+        }
+        if(currentGeneration == lastGeneration)
+        {
+            unique_lock<mutex> lock(wakeLock);
+            wakeCondition.wait(lock, [&]()
+            {
+                return done || generation.load(memory_order_relaxed) != lastGeneration;
+            });
+            if(done)
+                return;
+            currentGeneration = generation.load(memory_order_relaxed);
+        }
+        lastGeneration = currentGeneration;
+        work(workerIndex);
+    }
+}
+
+void RenderThreadPool::run(std::size_t taskCount, TaskFunction task, void *context)
+{
+    unique_lock<mutex> runLock(this->runLock, defer_lock);
+    if(inTask || taskCount <= 1 || workers.size() <= 1 || !runLock.try_lock())
+    {
+        for(size_t i = 0; i < taskCount; i++)
+            task(context, i);
+        return;
+    }
+    this->task.store(task, memory_order_relaxed);
+    this->context.store(context, memory_order_relaxed);
+    remainingTaskCount.store(taskCount, memory_order_relaxed);
+    for(size_t i = 0; i < workers.size(); i++)
+    {
+        uint64_t begin = taskCount * i / workers.size(), end = taskCount * (i + 1) / workers.size();
+        workers[i]->range.store((begin << 32) | end, memory_order_release);
+    }
+    {
+        lock_guard<mutex> lock(wakeLock);
+        generation.fetch_add(1, memory_order_release);
+    }
+    wakeCondition.notify_all();
+    work(0);
+    while(remainingTaskCount.load(memory_order_acquire) != 0)
+    {
+        work(0);
+        this_thread::yield();
+    }
+}
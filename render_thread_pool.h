@@ -0,0 +1,72 @@
+#ifndef RENDER_THREAD_POOL_H_INCLUDED
+#define RENDER_THREAD_POOL_H_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** @brief a small work-stealing thread pool for splitting a render block into tasks
+ *
+ * The thread calling run() works on the tasks too. Each thread starts with a contiguous range of tasks
+ * and takes tasks from the front of its range; threads that run out steal from the back of other ranges.
+ * Calling run() from inside a task or while another thread is in run() runs the tasks on the calling thread.
+ */
+class RenderThreadPool
+{
+public:
+    typedef void (*TaskFunction)(void *context, std::size_t taskIndex);
+private:
+    struct Worker
+    {
+        /** the remaining tasks: the first task in the high 32 bits and the end in the low 32 bits */
+        std::atomic<std::uint64_t> range;
+        std::thread thread;
+        Worker()
+            : range(0)
+        {
+        }
+    };
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::mutex runLock;
+    std::mutex wakeLock;
+    std::condition_variable wakeCondition;
+    /** counts the runs; only changed holding wakeLock, but read without it by workers spinning for the next run */
+    std::atomic<std::uint64_t> generation;
+    /** how many times an idle worker yields watching for the next run before sleeping */
+    unsigned spinCount;
+    bool done;
+    std::atomic<std::size_t> remainingTaskCount;
+    std::atomic<TaskFunction> task;
+    std::atomic<void *> context;
+    void workerMain(std::size_t workerIndex);
+    void work(std::size_t workerIndex);
+    static bool takeTask(Worker &worker, bool fromBack, std::size_t &taskIndex);
+public:
+    /** @brief construct a render thread pool
+     *
+     * @param threadCount the number of threads to run tasks on, including the thread calling run(), or 0 for one per hardware thread
+     *
+     */
+    explicit RenderThreadPool(unsigned threadCount = 0);
+    RenderThreadPool(const RenderThreadPool &) = delete;
+    const RenderThreadPool &operator =(const RenderThreadPool &) = delete;
+    ~RenderThreadPool();
+    std::size_t getThreadCount() const
+    {
+        return workers.size();
+    }
+    /** @brief run tasks and wait for them to finish
+     *
+     * @param taskCount the number of tasks
+     * @param task the function to call with each task index from 0 to taskCount - 1
+     * @param context passed to task
+     *
+     */
+    void run(std::size_t taskCount, TaskFunction task, void *context);
+};
+
+#endif // RENDER_THREAD_POOL_H_INCLUDED
@@ -0,0 +1,370 @@
+#include "sample_bank.h"
+#include "disk_streamer.h"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+/* Bank layout, all in native byte order:
+ *
+ * BankHeader
+ * BankKey[keyCount]
+ * BankAudioFile[audioFileCount]
+ * the instrument name and audio file paths
+ * the audio data of each audio file, aligned to AudioData::alignment:
+ *     channelCount channels of channelStride floats, including the zero padding
+ */
+constexpr char bankMagic[8] = {'M', 'I', 'D', 'I', 'B', 'A', 'N', 'K'};
+constexpr uint32_t bankVersion = 2;
+constexpr uint32_t bankByteOrderMark = 0x01020304;
+
+struct BankHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrderMark;
+    uint32_t channelCount;
+    uint32_t keyCount;
+    uint32_t audioFileCount;
+    uint32_t reserved;
+    uint64_t nameOffset;
+    uint64_t nameLength;
+    uint64_t fileSize;
+};
+
+struct BankKey
+{
+    double sourceBaseKey;
+    double attackSpeed;
+    double decaySpeed;
+    double sustainSpeed;
+    double releaseSpeed;
+    double releaseSpeedVariance;
+    double slideSpeed;
+    double aftertouchSpeed;
+    double loopDecayAmplitude;
+    float attackAmplitude;
+    float decayAmplitude;
+    uint64_t loopStart;
+    uint64_t loopEnd;
+    int32_t startKey;
+    int32_t endKey;
+    uint32_t firstAudioFile;
+    uint32_t audioFileCount;
+};
+
+struct BankAudioFile
+{
+    uint64_t pathOffset;
+    uint64_t pathLength;
+    double sampleRate;
+    uint64_t frameCount;
+    uint64_t channelStride;
+    uint64_t dataOffset;
+    uint64_t loopStart;
+    uint32_t looped;
+    float loopDecayAmplitude;
+    float channelAmplitudes[audioChannelCount];
+    float peak;
+    uint32_t reserved;
+};
+
+uint64_t alignOffset(uint64_t offset)
+{
+    return (offset + AudioData::alignment - 1) / AudioData::alignment * AudioData::alignment;
+}
+
+class MappedFile
+{
+    void *address;
+    size_t length;
+public:
+    MappedFile(const string &fileName)
+        : address(MAP_FAILED), length(0)
+    {
+        int fd = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0)
+            throw runtime_error("can't open file : " + fileName);
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size <= 0)
+        {
+            close(fd);
+            throw runtime_error("can't open file : " + fileName);
+        }
+        length = (size_t)st.st_size;
+        // read only, so the pages are shared through the page cache and nothing can write to them by mistake
+        address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(address == MAP_FAILED)
+            throw runtime_error("can't map file : " + fileName);
+        addAudioDataMemorySize(length);
+    }
+    MappedFile(const MappedFile &) = delete;
+    const MappedFile &operator =(const MappedFile &) = delete;
+    ~MappedFile()
+    {
+        munmap(address, length);
+        addAudioDataMemorySize(-(ptrdiff_t)length);
+    }
+    const char *data() const
+    {
+        return (const char *)address;
+    }
+    size_t size() const
+    {
+        return length;
+    }
+};
+}
+
+void writeBank(std::string fileName, const SampledInstrumentDescription &description)
+{
+    BankHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, bankMagic, sizeof(header.magic));
+    header.version = bankVersion;
+    header.byteOrderMark = bankByteOrderMark;
+    header.channelCount = audioChannelCount;
+    header.keyCount = description.keys.size();
+    vector<BankKey> keys;
+    vector<BankAudioFile> audioFiles;
+    vector<const AudioData *> audioData;
+    string strings = description.name;
+    for(const SampledInstrumentDescription::Key &key : description.keys)
+    {
+        BankKey bankKey;
+        memset(&bankKey, 0, sizeof(bankKey));
+        bankKey.sourceBaseKey = key.sourceBaseKey;
+        bankKey.attackSpeed = key.attackSpeed;
+        bankKey.decaySpeed = key.decaySpeed;
+        bankKey.sustainSpeed = key.sustainSpeed;
+        bankKey.releaseSpeed = key.releaseSpeed;
+        bankKey.releaseSpeedVariance = key.releaseSpeedVariance;
+        bankKey.slideSpeed = key.slideSpeed;
+        bankKey.aftertouchSpeed = key.aftertouchSpeed;
+        bankKey.loopDecayAmplitude = key.loopDecayAmplitude;
+        bankKey.attackAmplitude = key.attackAmplitude;
+        bankKey.decayAmplitude = key.decayAmplitude;
+        bankKey.loopStart = key.loopStart;
+        bankKey.loopEnd = key.loopEnd;
+        bankKey.startKey = key.startKey;
+        bankKey.endKey = key.endKey;
+        bankKey.firstAudioFile = audioFiles.size();
+        bankKey.audioFileCount = key.audioFiles.size();
+        for(const SampledInstrumentDescription::AudioFile &audioFile : key.audioFiles)
+        {
+            if(!audioFile.audioData)
+                throw runtime_error("audio not loaded : " + audioFile.path);
+            const AudioData &data = *audioFile.audioData;
+            BankAudioFile bankAudioFile;
+            memset(&bankAudioFile, 0, sizeof(bankAudioFile));
+            bankAudioFile.pathOffset = strings.size();
+            bankAudioFile.pathLength = audioFile.path.size();
+            strings += audioFile.path;
+            bankAudioFile.sampleRate = data.sampleRate;
+            bankAudioFile.frameCount = data.frameCount;
+            bankAudioFile.channelStride = alignOffset((data.frameCount + AudioData::paddingFrames) * sizeof(float)) / sizeof(float);
+            bankAudioFile.loopStart = data.loopStart;
+            bankAudioFile.looped = data.looped;
+            bankAudioFile.loopDecayAmplitude = data.loopDecayAmplitude;
+            bankAudioFile.peak = isinf(data.peak) ? data.computePeak() : data.peak;
+            for(size_t channel = 0; channel < audioChannelCount; channel++)
+                bankAudioFile.channelAmplitudes[channel] = audioFile.channelAmplitudes[channel];
+            audioFiles.push_back(bankAudioFile);
+            audioData.push_back(&data);
+        }
+        keys.push_back(bankKey);
+    }
+    header.audioFileCount = audioFiles.size();
+    uint64_t stringsOffset = sizeof(BankHeader) + keys.size() * sizeof(BankKey) + audioFiles.size() * sizeof(BankAudioFile);
+    header.nameOffset = stringsOffset;
+    header.nameLength = description.name.size();
+    uint64_t offset = stringsOffset + strings.size();
+    for(BankAudioFile &bankAudioFile : audioFiles)
+    {
+        bankAudioFile.pathOffset += stringsOffset;
+        offset = alignOffset(offset);
+        bankAudioFile.dataOffset = offset;
+        offset += bankAudioFile.channelStride * audioChannelCount * sizeof(float);
+    }
+    header.fileSize = offset;
+
+    ofstream os(fileName.c_str(), ios::binary | ios::trunc);
+    if(!os)
+        throw runtime_error("can't open file : " + fileName);
+    os.write((const char *)&header, sizeof(header));
+    if(!keys.empty())
+        os.write((const char *)&keys[0], keys.size() * sizeof(BankKey));
+    if(!audioFiles.empty())
+        os.write((const char *)&audioFiles[0], audioFiles.size() * sizeof(BankAudioFile));
+    os.write(strings.data(), strings.size());
+    offset = stringsOffset + strings.size();
+    vector<float> zeros, samples;
+    for(size_t i = 0; i < audioFiles.size(); i++)
+    {
+        const BankAudioFile &bankAudioFile = audioFiles[i];
+        const AudioData &data = *audioData[i];
+        static const char alignmentPadding[AudioData::alignment] = {};
+        os.write(alignmentPadding, bankAudioFile.dataOffset - offset);
+        zeros.assign(bankAudioFile.channelStride - data.frameCount, 0.0f);
+        for(size_t channel = 0; channel < audioChannelCount; channel++)
+        {
+            if(data.sampleFormat == AudioData::SampleFormat::Float32)
+                os.write((const char *)data.channels[channel], data.frameCount * sizeof(float));
+            else
+            {
+                // banks always hold floats
+                samples.resize(data.frameCount);
+                for(size_t i = 0; i < data.frameCount; i++)
+                    samples[i] = data.getSample(channel, i);
+                os.write((const char *)&samples[0], samples.size() * sizeof(float));
+            }
+            os.write((const char *)&zeros[0], zeros.size() * sizeof(float));
+        }
+        offset = bankAudioFile.dataOffset + bankAudioFile.channelStride * audioChannelCount * sizeof(float);
+    }
+    if(!os.flush())
+        throw runtime_error("can't write file : " + fileName);
+}
+
+SampledInstrumentDescription readBank(std::string fileName, std::shared_ptr<DiskStreamer> streamer, std::size_t residentFrameCount)
+{
+    shared_ptr<MappedFile> mapping = make_shared<MappedFile>(fileName);
+    shared_ptr<int> streamFile;
+    if(streamer)
+        streamFile = openStreamFile(fileName);
+    const char *base = mapping->data();
+    uint64_t fileSize = mapping->size();
+    auto validRange = [fileSize](uint64_t offset, uint64_t length)
+    {
+        return offset <= fileSize && length <= fileSize - offset;
+    };
+    BankHeader header;
+    if(!validRange(0, sizeof(header)))
+        throw runtime_error("invalid format : " + fileName);
+    memcpy(&header, base, sizeof(header));
+    if(memcmp(header.magic, bankMagic, sizeof(header.magic)) != 0 || header.byteOrderMark != bankByteOrderMark)
+        throw runtime_error("invalid format : " + fileName);
+    if(header.version != bankVersion || header.channelCount != audioChannelCount || header.fileSize != fileSize)
+        throw runtime_error("unsupported bank : " + fileName);
+    uint64_t keysOffset = sizeof(BankHeader);
+    uint64_t audioFilesOffset = keysOffset + (uint64_t)header.keyCount * sizeof(BankKey);
+    if(!validRange(keysOffset, (uint64_t)header.keyCount * sizeof(BankKey))
+            || !validRange(audioFilesOffset, (uint64_t)header.audioFileCount * sizeof(BankAudioFile))
+            || !validRange(header.nameOffset, header.nameLength))
+        throw runtime_error("invalid format : " + fileName);
+    const BankKey *keys = (const BankKey *)(base + keysOffset);
+    const BankAudioFile *audioFiles = (const BankAudioFile *)(base + audioFilesOffset);
+    SampledInstrumentDescription retval;
+    retval.name.assign(base + header.nameOffset, header.nameLength);
+    for(uint32_t keyIndex = 0; keyIndex < header.keyCount; keyIndex++)
+    {
+        const BankKey &bankKey = keys[keyIndex];
+        if(bankKey.firstAudioFile > header.audioFileCount || bankKey.audioFileCount > header.audioFileCount - bankKey.firstAudioFile)
+            throw runtime_error("invalid format : " + fileName);
+        SampledInstrumentDescription::Key key;
+        key.sourceBaseKey = bankKey.sourceBaseKey;
+        key.attackSpeed = bankKey.attackSpeed;
+        key.decaySpeed = bankKey.decaySpeed;
+        key.sustainSpeed = bankKey.sustainSpeed;
+        key.releaseSpeed = bankKey.releaseSpeed;
+        key.releaseSpeedVariance = bankKey.releaseSpeedVariance;
+        key.slideSpeed = bankKey.slideSpeed;
+        key.aftertouchSpeed = bankKey.aftertouchSpeed;
+        key.attackAmplitude = bankKey.attackAmplitude;
+        key.decayAmplitude = bankKey.decayAmplitude;
+        key.loopStart = bankKey.loopStart;
+        key.loopEnd = bankKey.loopEnd;
+        key.loopDecayAmplitude = bankKey.loopDecayAmplitude;
+        key.startKey = bankKey.startKey;
+        key.endKey = bankKey.endKey;
+        for(uint32_t i = 0; i < bankKey.audioFileCount; i++)
+        {
+            const BankAudioFile &bankAudioFile = audioFiles[bankKey.firstAudioFile + i];
+            uint64_t dataLength = bankAudioFile.channelStride * audioChannelCount * sizeof(float);
+            if(!validRange(bankAudioFile.pathOffset, bankAudioFile.pathLength)
+                    || bankAudioFile.dataOffset % AudioData::alignment != 0
+                    || bankAudioFile.channelStride > fileSize
+                    || !validRange(bankAudioFile.dataOffset, dataLength)
+                    || bankAudioFile.frameCount + AudioData::paddingFrames > bankAudioFile.channelStride
+                    || !(bankAudioFile.peak >= 0))
+                throw runtime_error("invalid format : " + fileName);
+            SampledInstrumentDescription::AudioFile audioFile;
+            audioFile.path.assign(base + bankAudioFile.pathOffset, bankAudioFile.pathLength);
+            for(size_t channel = 0; channel < audioChannelCount; channel++)
+                audioFile.channelAmplitudes[channel] = bankAudioFile.channelAmplitudes[channel];
+            shared_ptr<AudioData> audioData = make_shared<AudioData>();
+            const float *channelData = (const float *)(mapping->data() + bankAudioFile.dataOffset);
+            if(streamer && bankAudioFile.frameCount > residentFrameCount)
+            {
+                // keep a copy of the head and stream the rest
+                audioData->resize(residentFrameCount);
+                for(size_t channel = 0; channel < audioChannelCount; channel++)
+                {
+                    copy(channelData, channelData + residentFrameCount, audioData->getWritableChannel(channel));
+                    channelData += bankAudioFile.channelStride;
+                }
+                audioData->frameCount = bankAudioFile.frameCount;
+                audioData->stream = make_shared<AudioDataStream>(streamFile, bankAudioFile.dataOffset, bankAudioFile.channelStride, streamer);
+            }
+            else
+            {
+                for(const float *&channel : audioData->channels)
+                {
+                    channel = channelData;
+                    channelData += bankAudioFile.channelStride;
+                }
+                audioData->frameCount = bankAudioFile.frameCount;
+                audioData->residentFrameCount = bankAudioFile.frameCount;
+                audioData->channelStride = bankAudioFile.channelStride;
+                audioData->storage = mapping;
+            }
+            audioData->sampleRate = bankAudioFile.sampleRate;
+            audioData->loopStart = bankAudioFile.loopStart;
+            audioData->looped = bankAudioFile.looped != 0;
+            audioData->loopDecayAmplitude = bankAudioFile.loopDecayAmplitude;
+            audioData->peak = bankAudioFile.peak;
+            if(audioData->looped && audioData->loopStart >= audioData->frameCount)
+                throw runtime_error("invalid format : " + fileName);
+            audioFile.audioData = std::move(audioData);
+            key.audioFiles.push_back(std::move(audioFile));
+        }
+        retval.keys.push_back(std::move(key));
+    }
+    return retval;
+}
+
+std::shared_ptr<MidiInstrument> loadFromBank(std::string fileName, std::shared_ptr<DiskStreamer> streamer, std::size_t residentFrameCount)
+{
+    return makeSampledInstrument(readBank(std::move(fileName), std::move(streamer), residentFrameCount));
+}
+
+std::shared_ptr<MidiInstrument> loadInstrument(std::string path, unsigned threadCount, AudioData::SampleFormat sampleFormat, InterpolationMode interpolationMode, std::size_t mipLevelCount, std::shared_ptr<DiskStreamer> streamer, std::size_t residentFrameCount)
+{
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        return loadFromDirectory(std::move(path), threadCount, sampleFormat, interpolationMode, mipLevelCount);
+    SampledInstrumentDescription description = readBank(std::move(path), std::move(streamer), residentFrameCount);
+    if(sampleFormat != AudioData::SampleFormat::Float32 || mipLevelCount > 0)
+    {
+        for(SampledInstrumentDescription::Key &key : description.keys)
+        {
+            for(SampledInstrumentDescription::AudioFile &audioFile : key.audioFiles)
+            {
+                audioFile.audioData->buildMipLevels(mipLevelCount);
+                audioFile.audioData->convert(sampleFormat);
+            }
+        }
+    }
+    return makeSampledInstrument(description, interpolationMode);
+}
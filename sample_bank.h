@@ -0,0 +1,62 @@
+#ifndef SAMPLE_BANK_H_INCLUDED
+#define SAMPLE_BANK_H_INCLUDED
+
+#include "midi_key.h"
+#include <string>
+
+class DiskStreamer;
+
+/** the frames of streamed audio kept in memory by default, about a third of a second at 44.1kHz */
+constexpr std::size_t defaultStreamResidentFrameCount = 1 << 14;
+
+/** @brief write a compiled sample bank
+ *
+ * A sample bank holds the parsed key parameters and the decoded planar audio of an instrument,
+ * laid out so the audio can be used straight from a memory mapping of the file.
+ *
+ * @param fileName the bank file to write
+ * @param description the instrument description with every AudioFile::audioData loaded
+ *
+ */
+void writeBank(std::string fileName, const SampledInstrumentDescription &description);
+
+/** @brief read a compiled sample bank
+ *
+ * The bank is memory mapped; every AudioFile::audioData points into the mapping
+ * and keeps it alive. Pages are shared with other processes mapping the same bank
+ * until they are written to.
+ *
+ * With a streamer, audio longer than residentFrameCount is streamed instead:
+ * only its first residentFrameCount frames are kept in memory, which needs to
+ * cover the time the streamer takes to start reading from disk.
+ *
+ * @param fileName the bank file to read
+ * @param streamer the streamer for long audio or nullptr to map all the audio
+ * @param residentFrameCount the number of frames of streamed audio to keep in memory
+ * @return the instrument description with every AudioFile::audioData loaded
+ *
+ */
+SampledInstrumentDescription readBank(std::string fileName, std::shared_ptr<DiskStreamer> streamer = nullptr, std::size_t residentFrameCount = defaultStreamResidentFrameCount);
+
+std::shared_ptr<MidiInstrument> loadFromBank(std::string fileName, std::shared_ptr<DiskStreamer> streamer = nullptr, std::size_t residentFrameCount = defaultStreamResidentFrameCount);
+
+/** @brief load an instrument from a compiled sample bank or an instrument directory
+ *
+ * Banks store float samples that are played straight from the read only mapping. Loading one in an integer format
+ * copies its audio out of the mapping; mip levels are built in memory, leaving the mapped audio as it is.
+ * With a streamer, long audio in a bank is streamed from disk as readBank does and stays float without mip levels;
+ * instrument directories are always decoded into memory.
+ *
+ * @param path the bank file or instrument directory
+ * @param threadCount the number of threads to decode an instrument directory with or 0 for one per hardware thread
+ * @param sampleFormat the format to store the samples as
+ * @param interpolationMode how the instrument's samples are resampled
+ * @param mipLevelCount the most band limited half rate levels to build for each audio file
+ * @param streamer the streamer for long audio in a bank or nullptr to keep all the audio in memory
+ * @param residentFrameCount the number of frames of streamed audio to keep in memory
+ * @return the new instrument
+ *
+ */
+std::shared_ptr<MidiInstrument> loadInstrument(std::string path, unsigned threadCount = 0, AudioData::SampleFormat sampleFormat = AudioData::SampleFormat::Float32, InterpolationMode interpolationMode = InterpolationMode::Default, std::size_t mipLevelCount = 0, std::shared_ptr<DiskStreamer> streamer = nullptr, std::size_t residentFrameCount = defaultStreamResidentFrameCount);
+
+#endif // SAMPLE_BANK_H_INCLUDED
@@ -0,0 +1,137 @@
+#include "sample_conversion.h"
+#include <cmath>
+#include <algorithm>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+constexpr float int16Scale = 32768.0f;
+constexpr float int16Min = -32768.0f;
+constexpr float int16Max = 32767.0f;
+constexpr float int32Scale = 2147483648.0f;
+constexpr float int32Min = -2147483648.0f;
+/** the largest float below 2^31 */
+constexpr float int32Max = 2147483520.0f;
+/** converts a 16 bit random number to a fraction of 1 */
+constexpr float randomScale = 1.0f / (1 << 16);
+
+/** clamps so NaN saturates the same way as the vector code, which returns the limit */
+inline float saturate(float value, float minValue, float maxValue)
+{
+    value = value < maxValue ? value : maxValue;
+    return value > minValue ? value : minValue;
+}
+
+inline uint32_t nextRandom(uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+/** @brief convert up to TpdfDither::laneCount samples, one per lane of the dither
+ */
+void convertGroupToInt16(int16_t *output, const float *input, size_t sampleCount, TpdfDither *dither)
+{
+    float noise[TpdfDither::laneCount] = {};
+    if(dither)
+    {
+        for(size_t lane = 0; lane < TpdfDither::laneCount; lane++)
+        {
+            // the two halves of one random number are the two uniform values
+            uint32_t value = nextRandom(dither->state[lane]);
+            noise[lane] = (float)((int32_t)(value >> 16) - (int32_t)(value & 0xFFFF)) * randomScale;
+        }
+    }
+    for(size_t i = 0; i < sampleCount; i++)
+        output[i] = (int16_t)nearbyint(saturate(input[i] * int16Scale + noise[i], int16Min, int16Max));
+}
+
+#if defined(__SSE2__) || defined(__AVX__)
+inline __m128i nextRandom(__m128i &state)
+{
+    state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+    state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+    state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+    return state;
+}
+
+inline __m128 nextNoise(__m128i &state)
+{
+    __m128i value = nextRandom(state);
+    __m128i first = _mm_srli_epi32(value, 16);
+    __m128i second = _mm_and_si128(value, _mm_set1_epi32(0xFFFF));
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(first, second)), _mm_set1_ps(randomScale));
+}
+#endif
+}
+
+TpdfDither::TpdfDither(std::uint32_t seed)
+{
+    // xorshift gets stuck at 0, so every lane needs a different nonzero seed
+    for(size_t lane = 0; lane < laneCount; lane++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        state[lane] = seed != 0 ? seed : 1;
+    }
+}
+
+void convertToInt16(std::int16_t *output, const float *input, std::size_t sampleCount, TpdfDither *dither)
+{
+    size_t i = 0;
+#if defined(__SSE2__) || defined(__AVX__)
+    const __m128 scale = _mm_set1_ps(int16Scale);
+    const __m128 minValue = _mm_set1_ps(int16Min);
+    const __m128 maxValue = _mm_set1_ps(int16Max);
+    // separate generators for the two halves of each 8 samples, so they don't wait on each other
+    __m128i lowState = dither ? _mm_loadu_si128((const __m128i *)dither->state) : _mm_setzero_si128();
+    __m128i highState = dither ? _mm_loadu_si128((const __m128i *)(dither->state + 4)) : _mm_setzero_si128();
+    for(; i + 8 <= sampleCount; i += 8)
+    {
+        __m128 low = _mm_mul_ps(_mm_loadu_ps(input + i), scale);
+        __m128 high = _mm_mul_ps(_mm_loadu_ps(input + i + 4), scale);
+        if(dither)
+        {
+            low = _mm_add_ps(low, nextNoise(lowState));
+            high = _mm_add_ps(high, nextNoise(highState));
+        }
+        // keep the conversion in range, where out of range floats would become INT_MIN; the pack then can't overflow
+        low = _mm_max_ps(_mm_min_ps(low, maxValue), minValue);
+        high = _mm_max_ps(_mm_min_ps(high, maxValue), minValue);
+        __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(low), _mm_cvtps_epi32(high));
+        _mm_storeu_si128((__m128i *)(output + i), packed);
+    }
+    if(dither)
+    {
+        _mm_storeu_si128((__m128i *)dither->state, lowState);
+        _mm_storeu_si128((__m128i *)(dither->state + 4), highState);
+    }
+#endif
+    for(; i < sampleCount; i += TpdfDither::laneCount)
+        convertGroupToInt16(output + i, input + i, min(sampleCount - i, (size_t)TpdfDither::laneCount), dither);
+}
+
+void convertToInt32(std::int32_t *output, const float *input, std::size_t sampleCount)
+{
+    size_t i = 0;
+#if defined(__SSE2__) || defined(__AVX__)
+    const __m128 scale = _mm_set1_ps(int32Scale);
+    const __m128 minValue = _mm_set1_ps(int32Min);
+    const __m128 maxValue = _mm_set1_ps(int32Max);
+    for(; i + 4 <= sampleCount; i += 4)
+    {
+        __m128 value = _mm_mul_ps(_mm_loadu_ps(input + i), scale);
+        value = _mm_max_ps(_mm_min_ps(value, maxValue), minValue);
+        _mm_storeu_si128((__m128i *)(output + i), _mm_cvtps_epi32(value));
+    }
+#endif
+    for(; i < sampleCount; i++)
+        output[i] = (int32_t)nearbyint(saturate(input[i] * int32Scale, int32Min, int32Max));
+}
@@ -0,0 +1,45 @@
+#ifndef SAMPLE_CONVERSION_H_INCLUDED
+#define SAMPLE_CONVERSION_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+/** @brief the random state for triangular (TPDF) dither
+ *
+ * A xorshift generator for each of a group of 8 samples, so the vector and scalar
+ * conversions add the same noise. Only use one from a single thread at a time.
+ */
+struct TpdfDither
+{
+    static constexpr std::size_t laneCount = 8;
+    std::uint32_t state[laneCount];
+    explicit TpdfDither(std::uint32_t seed = 0x9E3779B9);
+};
+
+/** @brief convert float samples to 16 bit integers
+ *
+ * Samples are scaled by 32768, rounded to the nearest integer and saturated.
+ * With dither, the difference of two uniform random values of up to 1 LSB is added before rounding,
+ * so quiet signals fade into noise instead of distorting.
+ *
+ * @param output the sampleCount integers to write
+ * @param input the sampleCount samples to convert
+ * @param sampleCount the number of samples
+ * @param dither the dither state or nullptr for no dither
+ *
+ */
+void convertToInt16(std::int16_t *output, const float *input, std::size_t sampleCount, TpdfDither *dither = nullptr);
+
+/** @brief convert float samples to 32 bit integers
+ *
+ * Samples are scaled by 2^31 and saturated. A float's 24 bit mantissa scales exactly,
+ * so there is no rounding error to dither.
+ *
+ * @param output the sampleCount integers to write
+ * @param input the sampleCount samples to convert
+ * @param sampleCount the number of samples
+ *
+ */
+void convertToInt32(std::int32_t *output, const float *input, std::size_t sampleCount);
+
+#endif // SAMPLE_CONVERSION_H_INCLUDED
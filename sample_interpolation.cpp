@@ -0,0 +1,523 @@
+#include "sample_interpolation.h"
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+/** the channels of sample data in one storage format */
+template <typename T>
+using SampleChannels = array_AudioChannel<const T *>;
+
+inline float toFloat(float sample)
+{
+    return sample;
+}
+
+inline float toFloat(std::int16_t sample)
+{
+    return sample;
+}
+
+inline float toFloat(Int24Sample sample)
+{
+    return (std::int32_t)sample;
+}
+
+atomic<InterpolationMode> defaultInterpolationMode(InterpolationMode::Linear);
+
+/** @brief the windowed sinc filter at evenly spaced fractions
+ *
+ * Row k holds the tap weights for a fraction of k / phaseCount; the last row is for a fraction of 1,
+ * so the weights for any fraction are interpolated between two adjacent rows.
+ */
+struct SincTable
+{
+    static constexpr size_t phaseCount = 256;
+    static constexpr size_t tapCount = 16;
+    static constexpr size_t leadingTapCount = tapCount / 2 - 1;
+    alignas(16) float coefficients[phaseCount + 1][tapCount];
+    /** the largest sum of the magnitudes of a row */
+    float gain;
+    SincTable();
+};
+
+SincTable::SincTable()
+    : gain(0)
+{
+    // the cutoff is a little below nyquist so the transition band fits in the taps
+    const double cutoff = 0.9;
+    const double halfWidth = tapCount / 2;
+    for(size_t phase = 0; phase <= phaseCount; phase++)
+    {
+        double t = (double)phase / phaseCount;
+        double weights[tapCount];
+        double sum = 0;
+        for(size_t tap = 0; tap < tapCount; tap++)
+        {
+            // the distance of the tap from the position
+            double x = (double)tap - (double)leadingTapCount - t;
+            double sinc = x == 0 ? 1 : std::sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+            double window = 0;
+            if(std::abs(x) < halfWidth)
+                window = 0.42 + 0.5 * std::cos(M_PI * x / halfWidth) + 0.08 * std::cos(2 * M_PI * x / halfWidth);
+            weights[tap] = cutoff * sinc * window;
+            sum += weights[tap];
+        }
+        // normalized so constant signals pass unchanged
+        double magnitude = 0;
+        for(size_t tap = 0; tap < tapCount; tap++)
+        {
+            coefficients[phase][tap] = (float)(weights[tap] / sum);
+            magnitude += std::abs(coefficients[phase][tap]);
+        }
+        gain = std::max(gain, (float)magnitude);
+    }
+}
+
+const SincTable &getSincTable()
+{
+    static const SincTable retval;
+    return retval;
+}
+
+inline void getCubicWeights(float t, float *weights)
+{
+    float t2 = t * t, t3 = t2 * t;
+    weights[0] = 0.5f * (-t3 + 2 * t2 - t);
+    weights[1] = 0.5f * (3 * t3 - 5 * t2 + 2);
+    weights[2] = 0.5f * (-3 * t3 + 4 * t2 + t);
+    weights[3] = 0.5f * (t3 - t2);
+}
+
+inline void getSincWeights(const SincTable &table, float t, float *weights)
+{
+    float phase = t * SincTable::phaseCount;
+    size_t row = (size_t)phase;
+    float fraction = phase - (float)row;
+    const float *row0 = table.coefficients[row], *row1 = table.coefficients[row + 1];
+    for(size_t tap = 0; tap < SincTable::tapCount; tap++)
+        weights[tap] = row0[tap] + fraction * (row1[tap] - row0[tap]);
+}
+
+/** @brief interpolates one frame from weighted taps starting at firstIndex */
+template <typename T>
+inline void interpolateFrame(float *output, const SampleChannels<T> &channels, size_t firstIndex, const float *weights, size_t tapCount, float amplitude)
+{
+    for(size_t channel = 0; channel < audioChannelCount; channel++)
+    {
+        const T *samples = channels[channel] + firstIndex;
+        float sum = 0;
+        for(size_t tap = 0; tap < tapCount; tap++)
+            sum += weights[tap] * toFloat(samples[tap]);
+        output[channel] = amplitude * sum;
+    }
+}
+
+template <typename T>
+inline void interpolateFrame(float *output, const SampleChannels<T> &channels, SamplePhase position, float amplitude)
+{
+    size_t index = getSampleIndex(position);
+    float t = getSampleFraction(position);
+    for(size_t channel = 0; channel < audioChannelCount; channel++)
+    {
+        const T *samples = channels[channel] + index;
+        output[channel] = amplitude * ((1 - t) * toFloat(samples[0]) + t * toFloat(samples[1]));
+    }
+}
+
+#if defined(__SSE2__) || defined(__AVX__)
+/** loads the 2 adjacent samples at index into the low half of a vector */
+inline __m128 loadSamplePair(const float *samples, int index)
+{
+    return _mm_castpd_ps(_mm_load_sd((const double *)(samples + index)));
+}
+
+/** gathers samples[indices[k]] into sample1 and samples[indices[k] + 1] into sample2 */
+inline void gatherSamples(const float *samples, __m128i indices, __m128 &sample1, __m128 &sample2)
+{
+    __m128 pair0 = loadSamplePair(samples, _mm_cvtsi128_si32(indices));
+    __m128 pair1 = loadSamplePair(samples, _mm_cvtsi128_si32(_mm_shuffle_epi32(indices, 1)));
+    __m128 pair2 = loadSamplePair(samples, _mm_cvtsi128_si32(_mm_shuffle_epi32(indices, 2)));
+    __m128 pair3 = loadSamplePair(samples, _mm_cvtsi128_si32(_mm_shuffle_epi32(indices, 3)));
+    __m128 pairs01 = _mm_movelh_ps(pair0, pair1);
+    __m128 pairs23 = _mm_movelh_ps(pair2, pair3);
+    sample1 = _mm_shuffle_ps(pairs01, pairs23, _MM_SHUFFLE(2, 0, 2, 0));
+    sample2 = _mm_shuffle_ps(pairs01, pairs23, _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+/** loads the 2 adjacent samples at index as the low and high halves of an integer */
+inline std::int32_t loadSamplePair(const std::int16_t *samples, int index)
+{
+    std::int32_t retval;
+    std::memcpy(&retval, samples + index, sizeof(retval));
+    return retval;
+}
+
+inline void gatherSamples(const std::int16_t *samples, __m128i indices, __m128 &sample1, __m128 &sample2)
+{
+    __m128i pairs = _mm_set_epi32(loadSamplePair(samples, _mm_cvtsi128_si32(_mm_shuffle_epi32(indices, 3))),
+                                  loadSamplePair(samples, _mm_cvtsi128_si32(_mm_shuffle_epi32(indices, 2))),
+                                  loadSamplePair(samples, _mm_cvtsi128_si32(_mm_shuffle_epi32(indices, 1))),
+                                  loadSamplePair(samples, _mm_cvtsi128_si32(indices)));
+    // shifting right sign extends each half
+    sample1 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(pairs, 16), 16));
+    sample2 = _mm_cvtepi32_ps(_mm_srai_epi32(pairs, 16));
+}
+
+/** loads the 2 adjacent samples at index, shifted to the top 24 bits of each half */
+inline __m128i loadSamplePair(const Int24Sample *samples, int index)
+{
+    // 8 bytes cover both samples; the extra bytes are in the padding
+    std::uint64_t bytes;
+    std::memcpy(&bytes, samples + index, sizeof(bytes));
+    return _mm_set_epi32(0, 0, (int)(std::uint32_t)(bytes >> 16), (int)((std::uint32_t)bytes << 8));
+}
+
+inline void gatherSamples(const Int24Sample *samples, __m128i indices, __m128 &sample1, __m128 &sample2)
+{
+    __m128i pair0 = loadSamplePair(samples, _mm_cvtsi128_si32(indices));
+    __m128i pair1 = loadSamplePair(samples, _mm_cvtsi128_si32(_mm_shuffle_epi32(indices, 1)));
+    __m128i pair2 = loadSamplePair(samples, _mm_cvtsi128_si32(_mm_shuffle_epi32(indices, 2)));
+    __m128i pair3 = loadSamplePair(samples, _mm_cvtsi128_si32(_mm_shuffle_epi32(indices, 3)));
+    __m128 pairs01 = _mm_castsi128_ps(_mm_unpacklo_epi64(pair0, pair1));
+    __m128 pairs23 = _mm_castsi128_ps(_mm_unpacklo_epi64(pair2, pair3));
+    // shifting right sign extends
+    sample1 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_castps_si128(_mm_shuffle_ps(pairs01, pairs23, _MM_SHUFFLE(2, 0, 2, 0))), 8));
+    sample2 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_castps_si128(_mm_shuffle_ps(pairs01, pairs23, _MM_SHUFFLE(3, 1, 3, 1))), 8));
+}
+
+/** gathers samples[indices[k]] */
+inline __m128 gatherSamples(const float *samples, __m128i indices)
+{
+    return _mm_set_ps(samples[_mm_cvtsi128_si32(_mm_shuffle_epi32(indices, 3))],
+                      samples[_mm_cvtsi128_si32(_mm_shuffle_epi32(indices, 2))],
+                      samples[_mm_cvtsi128_si32(_mm_shuffle_epi32(indices, 1))],
+                      samples[_mm_cvtsi128_si32(indices)]);
+}
+
+inline __m128 gatherSamples(const std::int16_t *samples, __m128i indices)
+{
+    return _mm_cvtepi32_ps(_mm_set_epi32(samples[_mm_cvtsi128_si32(_mm_shuffle_epi32(indices, 3))],
+                                         samples[_mm_cvtsi128_si32(_mm_shuffle_epi32(indices, 2))],
+                                         samples[_mm_cvtsi128_si32(_mm_shuffle_epi32(indices, 1))],
+                                         samples[_mm_cvtsi128_si32(indices)]));
+}
+
+inline __m128 gatherSamples(const Int24Sample *samples, __m128i indices)
+{
+    return _mm_cvtepi32_ps(_mm_set_epi32((std::int32_t)samples[_mm_cvtsi128_si32(_mm_shuffle_epi32(indices, 3))],
+                                         (std::int32_t)samples[_mm_cvtsi128_si32(_mm_shuffle_epi32(indices, 2))],
+                                         (std::int32_t)samples[_mm_cvtsi128_si32(_mm_shuffle_epi32(indices, 1))],
+                                         (std::int32_t)samples[_mm_cvtsi128_si32(indices)]));
+}
+
+/** the whole frame indices of the phases of 4 frames, given as 2 vectors of 64 bit phases */
+inline __m128i getPhaseIndices(__m128i phases01, __m128i phases23)
+{
+    return _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(phases01), _mm_castsi128_ps(phases23), _MM_SHUFFLE(3, 1, 3, 1)));
+}
+
+/** the fractions of the phases of 4 frames between 0 and 1, as getSampleFraction */
+inline __m128 getPhaseFractions(__m128i phases01, __m128i phases23)
+{
+    __m128i fractions = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(phases01), _mm_castsi128_ps(phases23), _MM_SHUFFLE(2, 0, 2, 0)));
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(fractions, 8)), _mm_set1_ps(1.0f / (1 << 24)));
+}
+
+/** reads 4 frames without interpolating and stores them interleaved */
+template <typename T>
+inline void readFrames(float *output, const SampleChannels<T> &channels, __m128i indices, __m128 amplitude)
+{
+    __m128 left = _mm_mul_ps(gatherSamples(channels[(size_t)AudioChannel::Left], indices), amplitude);
+    __m128 right = _mm_mul_ps(gatherSamples(channels[(size_t)AudioChannel::Right], indices), amplitude);
+    _mm_storeu_ps(output, _mm_unpacklo_ps(left, right));
+    _mm_storeu_ps(output + 4, _mm_unpackhi_ps(left, right));
+}
+
+/** interpolates 4 frames of one channel */
+template <typename T>
+inline __m128 interpolateChannel(const T *samples, __m128i indices, __m128 t, __m128 amplitude)
+{
+    __m128 sample1, sample2;
+    gatherSamples(samples, indices, sample1, sample2);
+    return _mm_mul_ps(_mm_add_ps(sample1, _mm_mul_ps(t, _mm_sub_ps(sample2, sample1))), amplitude);
+}
+
+/** interpolates 4 frames and stores them interleaved */
+template <typename T>
+inline void interpolateFrames(float *output, const SampleChannels<T> &channels, __m128i indices, __m128 t, __m128 amplitude)
+{
+    __m128 left = interpolateChannel(channels[(size_t)AudioChannel::Left], indices, t, amplitude);
+    __m128 right = interpolateChannel(channels[(size_t)AudioChannel::Right], indices, t, amplitude);
+    _mm_storeu_ps(output, _mm_unpacklo_ps(left, right));
+    _mm_storeu_ps(output + 4, _mm_unpackhi_ps(left, right));
+}
+
+/** loads 4 adjacent samples */
+inline __m128 loadSamples(const float *samples)
+{
+    return _mm_loadu_ps(samples);
+}
+
+inline __m128 loadSamples(const std::int16_t *samples)
+{
+    __m128i packed = _mm_loadl_epi64((const __m128i *)samples);
+    // unpacking with itself puts each sample in the top half so shifting right sign extends it
+    return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(packed, packed), 16));
+}
+
+inline __m128 loadSamples(const Int24Sample *samples)
+{
+    return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi64(loadSamplePair(samples, 0), loadSamplePair(samples, 2)), 8));
+}
+
+/** sums the weighted taps of each channel and stores them as one frame */
+inline void storeFrame(float *output, __m128 left, __m128 right, __m128 amplitude)
+{
+    // [l0 + l2, r0 + r2, l1 + l3, r1 + r3]
+    __m128 sums = _mm_add_ps(_mm_unpacklo_ps(left, right), _mm_unpackhi_ps(left, right));
+    sums = _mm_add_ps(sums, _mm_movehl_ps(sums, sums));
+    _mm_storel_pi((__m64 *)output, _mm_mul_ps(sums, amplitude));
+}
+#endif
+
+template <typename T>
+void interpolateNone(float *output, size_t frameCount, const SampleChannels<T> &data, SamplePhase position, SamplePhase step, float amplitude)
+{
+    size_t frame = 0;
+#if defined(__SSE2__) || defined(__AVX__)
+    static_assert(audioChannelCount == 2, "SIMD interpolation assumes stereo frames");
+    static_assert(samplePhaseFractionBits == 32, "SIMD interpolation assumes the index and fraction are the halves of the phase");
+    const __m128 amplitudeVector = _mm_set1_ps(amplitude);
+    // the phases of 4 frames as 64 bit integers, advanced by exact integer steps
+    __m128i phases01 = _mm_set_epi64x((long long)(position + step), (long long)position);
+    __m128i phases23 = _mm_set_epi64x((long long)(position + 3 * step), (long long)(position + 2 * step));
+    const __m128i phaseIncrement = _mm_set1_epi64x((long long)(4 * step));
+    for(; frame + 4 <= frameCount; frame += 4)
+    {
+        readFrames(output + frame * audioChannelCount, data, getPhaseIndices(phases01, phases23), amplitudeVector);
+        phases01 = _mm_add_epi64(phases01, phaseIncrement);
+        phases23 = _mm_add_epi64(phases23, phaseIncrement);
+    }
+    output += frame * audioChannelCount;
+    position += frame * step;
+#endif
+    for(; frame < frameCount; frame++, position += step)
+    {
+        size_t index = getSampleIndex(position);
+        for(size_t channel = 0; channel < audioChannelCount; channel++)
+            *output++ = amplitude * toFloat(data[channel][index]);
+    }
+}
+
+template <typename T>
+void interpolateLinear(float *output, size_t frameCount, const SampleChannels<T> &data, SamplePhase position, SamplePhase step, float amplitude)
+{
+    size_t frame = 0;
+#if defined(__SSE2__) || defined(__AVX__)
+    static_assert(audioChannelCount == 2, "SIMD interpolation assumes stereo frames");
+    static_assert(samplePhaseFractionBits == 32, "SIMD interpolation assumes the index and fraction are the halves of the phase");
+    const __m128 amplitudeVector = _mm_set1_ps(amplitude);
+    // the phases of 4 frames as 64 bit integers, advanced by exact integer steps
+    __m128i phases01 = _mm_set_epi64x((long long)(position + step), (long long)position);
+    __m128i phases23 = _mm_set_epi64x((long long)(position + 3 * step), (long long)(position + 2 * step));
+    const __m128i phaseIncrement = _mm_set1_epi64x((long long)(4 * step));
+    for(; frame + 4 <= frameCount; frame += 4)
+    {
+        interpolateFrames(output + frame * audioChannelCount, data, getPhaseIndices(phases01, phases23), getPhaseFractions(phases01, phases23), amplitudeVector);
+        phases01 = _mm_add_epi64(phases01, phaseIncrement);
+        phases23 = _mm_add_epi64(phases23, phaseIncrement);
+    }
+#endif
+    for(; frame < frameCount; frame++)
+    {
+        interpolateFrame(output + frame * audioChannelCount, data, position + frame * step, amplitude);
+    }
+}
+
+template <typename T>
+void interpolateCubic(float *output, size_t frameCount, const SampleChannels<T> &data, SamplePhase position, SamplePhase step, float amplitude)
+{
+    size_t frame = 0;
+#if defined(__SSE2__) || defined(__AVX__)
+    const __m128 amplitudeVector = _mm_set1_ps(amplitude);
+    // the weight polynomials of the 4 taps, evaluated together with Horner's method
+    const __m128 cubicTerm = _mm_set_ps(0.5f, -1.5f, 1.5f, -0.5f);
+    const __m128 squareTerm = _mm_set_ps(-0.5f, 2.0f, -2.5f, 1.0f);
+    const __m128 linearTerm = _mm_set_ps(0.0f, 0.5f, 0.0f, -0.5f);
+    const __m128 constantTerm = _mm_set_ps(0.0f, 0.0f, 1.0f, 0.0f);
+    for(; frame < frameCount; frame++, position += step)
+    {
+        __m128 t = _mm_set1_ps(getSampleFraction(position));
+        __m128 weights = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(cubicTerm, t), squareTerm), t), linearTerm), t), constantTerm);
+        size_t firstIndex = getSampleIndex(position) - 1;
+        __m128 left = _mm_mul_ps(weights, loadSamples(data[(size_t)AudioChannel::Left] + firstIndex));
+        __m128 right = _mm_mul_ps(weights, loadSamples(data[(size_t)AudioChannel::Right] + firstIndex));
+        storeFrame(output + frame * audioChannelCount, left, right, amplitudeVector);
+    }
+#endif
+    for(; frame < frameCount; frame++, position += step)
+    {
+        float weights[4];
+        getCubicWeights(getSampleFraction(position), weights);
+        interpolateFrame(output + frame * audioChannelCount, data, getSampleIndex(position) - 1, weights, 4, amplitude);
+    }
+}
+
+template <typename T>
+void interpolateSinc(float *output, size_t frameCount, const SampleChannels<T> &data, SamplePhase position, SamplePhase step, float amplitude)
+{
+    const SincTable &table = getSincTable();
+    size_t frame = 0;
+#if defined(__SSE2__) || defined(__AVX__)
+    const __m128 amplitudeVector = _mm_set1_ps(amplitude);
+    for(; frame < frameCount; frame++, position += step)
+    {
+        float phase = getSampleFraction(position) * SincTable::phaseCount;
+        size_t row = (size_t)phase;
+        __m128 fraction = _mm_set1_ps(phase - (float)row);
+        const float *row0 = table.coefficients[row], *row1 = table.coefficients[row + 1];
+        size_t firstIndex = getSampleIndex(position) - SincTable::leadingTapCount;
+        const T *leftSamples = data[(size_t)AudioChannel::Left] + firstIndex;
+        const T *rightSamples = data[(size_t)AudioChannel::Right] + firstIndex;
+        __m128 left = _mm_setzero_ps(), right = _mm_setzero_ps();
+        for(size_t tap = 0; tap < SincTable::tapCount; tap += 4)
+        {
+            __m128 weights0 = _mm_load_ps(row0 + tap);
+            __m128 weights = _mm_add_ps(weights0, _mm_mul_ps(fraction, _mm_sub_ps(_mm_load_ps(row1 + tap), weights0)));
+            left = _mm_add_ps(left, _mm_mul_ps(weights, loadSamples(leftSamples + tap)));
+            right = _mm_add_ps(right, _mm_mul_ps(weights, loadSamples(rightSamples + tap)));
+        }
+        storeFrame(output + frame * audioChannelCount, left, right, amplitudeVector);
+    }
+#endif
+    for(; frame < frameCount; frame++, position += step)
+    {
+        float weights[SincTable::tapCount];
+        getSincWeights(table, getSampleFraction(position), weights);
+        interpolateFrame(output + frame * audioChannelCount, data, getSampleIndex(position) - SincTable::leadingTapCount, weights, SincTable::tapCount, amplitude);
+    }
+}
+
+template <typename T>
+void interpolateSamples(float *output, size_t frameCount, const SampleChannels<T> &data, SamplePhase position, SamplePhase step, float amplitude, InterpolationMode mode)
+{
+    switch(resolveInterpolationMode(mode))
+    {
+    case InterpolationMode::None:
+        interpolateNone(output, frameCount, data, position, step, amplitude);
+        return;
+    case InterpolationMode::Cubic:
+        interpolateCubic(output, frameCount, data, position, step, amplitude);
+        return;
+    case InterpolationMode::Sinc:
+        interpolateSinc(output, frameCount, data, position, step, amplitude);
+        return;
+    default:
+        interpolateLinear(output, frameCount, data, position, step, amplitude);
+        return;
+    }
+}
+
+template <typename T>
+SampleChannels<T> getSampleChannels(const array_AudioChannel<const void *> &channels)
+{
+    SampleChannels<T> retval;
+    for(size_t channel = 0; channel < audioChannelCount; channel++)
+        retval[channel] = (const T *)channels[channel];
+    return retval;
+}
+}
+
+InterpolationMode getDefaultInterpolationMode()
+{
+    return defaultInterpolationMode.load(memory_order_relaxed);
+}
+
+void setDefaultInterpolationMode(InterpolationMode mode)
+{
+    if(mode == InterpolationMode::Default)
+        mode = InterpolationMode::Linear;
+    defaultInterpolationMode.store(mode, memory_order_relaxed);
+}
+
+InterpolationMode parseInterpolationMode(const std::string &name)
+{
+    if(name == "default")
+        return InterpolationMode::Default;
+    if(name == "none")
+        return InterpolationMode::None;
+    if(name == "linear")
+        return InterpolationMode::Linear;
+    if(name == "cubic")
+        return InterpolationMode::Cubic;
+    if(name == "sinc")
+        return InterpolationMode::Sinc;
+    throw runtime_error("invalid interpolation mode : " + name);
+}
+
+void getInterpolationWeights(InterpolationMode mode, float t, float *weights)
+{
+    switch(resolveInterpolationMode(mode))
+    {
+    case InterpolationMode::None:
+        weights[0] = 1;
+        return;
+    case InterpolationMode::Cubic:
+        getCubicWeights(t, weights);
+        return;
+    case InterpolationMode::Sinc:
+        getSincWeights(getSincTable(), t, weights);
+        return;
+    default:
+        weights[0] = 1 - t;
+        weights[1] = t;
+        return;
+    }
+}
+
+float getInterpolationGain(InterpolationMode mode)
+{
+    switch(resolveInterpolationMode(mode))
+    {
+    case InterpolationMode::Cubic:
+        // the weights at a fraction of 0.5 are -1/16, 9/16, 9/16 and -1/16
+        return 1.25f;
+    case InterpolationMode::Sinc:
+        return getSincTable().gain;
+    default:
+        return 1;
+    }
+}
+
+void interpolateSamples(float *output, size_t frameCount, const AudioData &data, SamplePhase position, SamplePhase step, float amplitude, InterpolationMode mode)
+{
+    // integer samples are scaled along with the amplitude
+    switch(data.sampleFormat)
+    {
+    case AudioData::SampleFormat::Float32:
+    {
+        SampleChannels<float> channels;
+        for(size_t channel = 0; channel < audioChannelCount; channel++)
+            channels[channel] = data.channels[channel];
+        interpolateSamples(output, frameCount, channels, position, step, amplitude, mode);
+        return;
+    }
+    case AudioData::SampleFormat::Int16:
+        interpolateSamples(output, frameCount, getSampleChannels<std::int16_t>(data.compactChannels), position, step, amplitude * data.sampleScale, mode);
+        return;
+    case AudioData::SampleFormat::Int24:
+        interpolateSamples(output, frameCount, getSampleChannels<Int24Sample>(data.compactChannels), position, step, amplitude * data.sampleScale, mode);
+        return;
+    }
+}
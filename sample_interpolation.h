@@ -0,0 +1,157 @@
+#ifndef SAMPLE_INTERPOLATION_H_INCLUDED
+#define SAMPLE_INTERPOLATION_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "audio_data.h"
+
+/** a fractional frame index in 32.32 fixed point */
+typedef std::uint64_t SamplePhase;
+
+constexpr int samplePhaseFractionBits = 32;
+constexpr SamplePhase samplePhaseOne = (SamplePhase)1 << samplePhaseFractionBits;
+
+inline SamplePhase toSamplePhase(double position)
+{
+    return (SamplePhase)(position * (double)samplePhaseOne + 0.5);
+}
+
+inline SamplePhase getFramePhase(std::size_t frameIndex)
+{
+    return (SamplePhase)frameIndex << samplePhaseFractionBits;
+}
+
+inline std::size_t getSampleIndex(SamplePhase phase)
+{
+    return (std::size_t)(phase >> samplePhaseFractionBits);
+}
+
+/** @brief get the fraction of a phase between its frame and the next
+ *
+ * Only the top 24 bits of the fraction are used so it converts to float exactly and stays below 1.
+ */
+inline float getSampleFraction(SamplePhase phase)
+{
+    return (float)((std::uint32_t)phase >> 8) * (1.0f / (1 << 24));
+}
+
+/** @brief how sampled audio is resampled to the output rate
+ *
+ * Cost of one stereo voice playing a long sample (SSE2), in ns per frame for float / 16 bit / 24 bit samples:
+ * None 0.7 / 0.9 / 2.3, Linear 1.1 / 1.4 / 2.7, Cubic 2.7 / 3.1 / 5.7 and Sinc 8.8 / 10.4 / 19.
+ */
+enum class InterpolationMode
+{
+    /** use the process wide default set with setDefaultInterpolationMode */
+    Default,
+    /** the frame at or before the position, with no interpolation */
+    None,
+    /** 2 point linear */
+    Linear,
+    /** 4 point cubic Hermite (Catmull-Rom) */
+    Cubic,
+    /** 16 point Blackman windowed sinc from a polyphase coefficient table */
+    Sinc,
+};
+
+constexpr std::size_t maxInterpolationTapCount = 16;
+
+static_assert(maxInterpolationTapCount <= AudioData::paddingFrames, "interpolation can't read past the padding");
+
+/** @brief get the process wide interpolation mode used by sources set to InterpolationMode::Default
+ */
+InterpolationMode getDefaultInterpolationMode();
+
+/** @brief set the process wide interpolation mode
+ *
+ * Safe to call while rendering; sources pick it up at their next block.
+ *
+ * @param mode the new default; InterpolationMode::Default restores linear interpolation
+ *
+ */
+void setDefaultInterpolationMode(InterpolationMode mode);
+
+/** @brief parse the name of an interpolation mode
+ *
+ * @param name none, linear, cubic, sinc or default
+ * @return the interpolation mode
+ * @throw std::runtime_error if the name isn't a mode
+ *
+ */
+InterpolationMode parseInterpolationMode(const std::string &name);
+
+inline InterpolationMode resolveInterpolationMode(InterpolationMode mode)
+{
+    if(mode == InterpolationMode::Default)
+        return getDefaultInterpolationMode();
+    return mode;
+}
+
+/** @brief get the number of frames read for each output frame
+ */
+inline std::size_t getInterpolationTapCount(InterpolationMode mode)
+{
+    switch(resolveInterpolationMode(mode))
+    {
+    case InterpolationMode::None:
+        return 1;
+    case InterpolationMode::Cubic:
+        return 4;
+    case InterpolationMode::Sinc:
+        return 16;
+    default:
+        return 2;
+    }
+}
+
+/** @brief get the number of frames read before the frame at or before the position
+ */
+inline std::size_t getInterpolationLeadingTapCount(InterpolationMode mode)
+{
+    switch(resolveInterpolationMode(mode))
+    {
+    case InterpolationMode::Cubic:
+        return 1;
+    case InterpolationMode::Sinc:
+        return 7;
+    default:
+        return 0;
+    }
+}
+
+/** @brief get the weights of the frames read for one output frame
+ *
+ * @param mode the interpolation mode
+ * @param t the fraction of the position past its frame, from 0 to 1
+ * @param weights the getInterpolationTapCount(mode) weights to write, first tap first
+ *
+ */
+void getInterpolationWeights(InterpolationMode mode, float t, float *weights);
+
+/** @brief get a bound on how far interpolation can overshoot the frames it reads
+ *
+ * @return the largest sum of the magnitudes of the weights
+ *
+ */
+float getInterpolationGain(InterpolationMode mode);
+
+/** @brief interpolate a block of frames from planar sample data
+ *
+ * Output frame k is read at position + k * step, from the frames
+ * getSampleIndex(position + k * step) - getInterpolationLeadingTapCount(mode) on,
+ * getInterpolationTapCount(mode) of them. Every frame read must be resident or padding,
+ * so the first has to be at least 0 and the last less than data.frameCount + AudioData::paddingFrames.
+ *
+ * @param output the buffer to write frameCount * audioChannelCount interleaved samples to
+ * @param frameCount the number of frames to generate
+ * @param data the sample data
+ * @param position the phase of the first output frame
+ * @param step the phase increment per output frame
+ * @param amplitude the amplitude to scale the output by
+ * @param mode the interpolation mode
+ *
+ */
+void interpolateSamples(float *output, std::size_t frameCount, const AudioData &data, SamplePhase position, SamplePhase step, float amplitude, InterpolationMode mode);
+
+#endif // SAMPLE_INTERPOLATION_H_INCLUDED
@@ -0,0 +1,181 @@
+#include "wav_audio_output.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+using namespace std;
+
+namespace
+{
+constexpr uint16_t wavFormatPcm = 1;
+constexpr uint16_t wavFormatIeeeFloat = 3;
+
+void putLittleEndian(char *&output, uint32_t value, size_t byteCount)
+{
+    for(size_t i = 0; i < byteCount; i++)
+        *output++ = (char)(value >> (8 * i));
+}
+
+/** @brief round a sample to the nearest integer of bitCount bits, saturating like convertToInt16 */
+int32_t quantize(float value, int bitCount)
+{
+    float maxValue = (float)((1 << (bitCount - 1)) - 1);
+    value = nearbyint(value * (maxValue + 1));
+    // NaN saturates to the top too
+    value = value < maxValue ? value : maxValue;
+    value = value > -maxValue - 1 ? value : -maxValue - 1;
+    return (int32_t)value;
+}
+}
+
+constexpr unsigned WavAudioOutput::defaultSampleRate;
+constexpr std::size_t WavAudioOutput::defaultBlockFrameCount;
+constexpr float WavAudioOutput::silenceThreshold;
+
+WavAudioOutput::WavAudioOutput(std::string fileName, SampleFormat sampleFormat, unsigned sampleRate, std::size_t blockFrameCount)
+    : fileName(fileName), os(fileName.c_str(), ios::binary | ios::trunc), sampleFormat(sampleFormat), sampleRate(sampleRate), blockFrameCount(blockFrameCount), writtenFrameCount(0), ditherEnabled(false)
+{
+    assert(blockFrameCount > 0);
+    if(!os)
+        throw runtime_error("can't open file : " + fileName);
+    buffer.resize(blockFrameCount * audioChannelCount);
+    if(sampleFormat == SampleFormat::Int16)
+        samples16.resize(blockFrameCount * audioChannelCount);
+    bytes.resize(blockFrameCount * audioChannelCount * getBytesPerSample());
+    writeHeader();
+}
+
+std::size_t WavAudioOutput::getBytesPerSample() const
+{
+    switch(sampleFormat)
+    {
+    case SampleFormat::Int16:
+        return 2;
+    case SampleFormat::Int24:
+        return 3;
+    case SampleFormat::Float32:
+        return 4;
+    }
+    assert(false);
+    return 0;
+}
+
+void WavAudioOutput::writeHeader()
+{
+    bool isFloat = sampleFormat == SampleFormat::Float32;
+    uint32_t bytesPerFrame = getBytesPerSample() * audioChannelCount;
+    uint32_t dataSize = (uint32_t)min<uint64_t>(writtenFrameCount * bytesPerFrame, numeric_limits<uint32_t>::max() - 64);
+    // non-pcm formats need the extension size and a fact chunk
+    uint32_t formatSize = isFloat ? 18 : 16;
+    uint32_t factSize = isFloat ? 12 : 0;
+    char header[58];
+    char *output = header;
+    memcpy(output, "RIFF", 4);
+    output += 4;
+    putLittleEndian(output, 4 + 8 + formatSize + factSize + 8 + dataSize, 4);
+    memcpy(output, "WAVEfmt ", 8);
+    output += 8;
+    putLittleEndian(output, formatSize, 4);
+    putLittleEndian(output, isFloat ? wavFormatIeeeFloat : wavFormatPcm, 2);
+    putLittleEndian(output, audioChannelCount, 2);
+    putLittleEndian(output, sampleRate, 4);
+    putLittleEndian(output, sampleRate * bytesPerFrame, 4);
+    putLittleEndian(output, bytesPerFrame, 2);
+    putLittleEndian(output, getBytesPerSample() * 8, 2);
+    if(isFloat)
+    {
+        putLittleEndian(output, 0, 2);
+        memcpy(output, "fact", 4);
+        output += 4;
+        putLittleEndian(output, 4, 4);
+        putLittleEndian(output, (uint32_t)min<uint64_t>(writtenFrameCount, numeric_limits<uint32_t>::max()), 4);
+    }
+    memcpy(output, "data", 4);
+    output += 4;
+    putLittleEndian(output, dataSize, 4);
+    os.seekp(0);
+    os.write(header, output - header);
+}
+
+void WavAudioOutput::writeBlock(std::size_t frameCount)
+{
+    char *output = &bytes[0];
+    size_t sampleCount = frameCount * audioChannelCount;
+    switch(sampleFormat)
+    {
+    case SampleFormat::Int16:
+        convertToInt16(&samples16[0], &buffer[0], sampleCount, ditherEnabled ? &dither : nullptr);
+        for(size_t i = 0; i < sampleCount; i++)
+            putLittleEndian(output, (uint16_t)samples16[i], 2);
+        break;
+    case SampleFormat::Int24:
+        for(size_t i = 0; i < sampleCount; i++)
+            putLittleEndian(output, (uint32_t)quantize(buffer[i], 24), 3);
+        break;
+    case SampleFormat::Float32:
+        for(size_t i = 0; i < sampleCount; i++)
+        {
+            uint32_t bits;
+            memcpy(&bits, &buffer[i], sizeof(bits));
+            putLittleEndian(output, bits, 4);
+        }
+        break;
+    }
+    os.write(&bytes[0], output - &bytes[0]);
+    writtenFrameCount += frameCount;
+}
+
+void WavAudioOutput::bind(std::shared_ptr<AudioSource> src)
+{
+    unique_lock<mutex> lockIt(sourceLock);
+    assert(source == nullptr);
+    source = std::move(src);
+}
+
+WavAudioOutput::Statistics WavAudioOutput::render(double maxDuration, std::function<bool()> finished)
+{
+    auto startTime = chrono::steady_clock::now();
+    double sampleDuration = 1.0 / sampleRate;
+    uint64_t startFrameCount = writtenFrameCount;
+    uint64_t maxFrameCount = isinf(maxDuration) ? numeric_limits<uint64_t>::max() : (uint64_t)max(0.0, ceil(maxDuration * sampleRate));
+    bool waitingForSilence = false;
+    while(writtenFrameCount - startFrameCount < maxFrameCount)
+    {
+        size_t frameCount = (size_t)min<uint64_t>(blockFrameCount, maxFrameCount - (writtenFrameCount - startFrameCount));
+        bool silent = true;
+        {
+            unique_lock<mutex> lockIt(sourceLock);
+            // only blocks the source reports as audible need scanning
+            if(source && source->render(&buffer[0], frameCount, sampleDuration))
+            {
+                for(size_t i = 0; i < frameCount * audioChannelCount; i++)
+                {
+                    if(abs(buffer[i]) >= silenceThreshold)
+                    {
+                        silent = false;
+                        break;
+                    }
+                }
+            }
+            else if(!source)
+                fill_n(buffer.begin(), frameCount * audioChannelCount, 0.0f);
+            if(!waitingForSilence && finished && finished())
+                waitingForSilence = true;
+        }
+        writeBlock(frameCount);
+        if(waitingForSilence && silent)
+            break;
+    }
+    writeHeader();
+    os.seekp(0, ios::end);
+    if(!os.flush())
+        throw runtime_error("can't write file : " + fileName);
+    Statistics retval;
+    retval.renderedDuration = (writtenFrameCount - startFrameCount) * sampleDuration;
+    retval.elapsedTime = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    return retval;
+}
@@ -0,0 +1,110 @@
+#ifndef WAV_AUDIO_OUTPUT_H_INCLUDED
+#define WAV_AUDIO_OUTPUT_H_INCLUDED
+
+#include "audio_output.h"
+#include "sample_conversion.h"
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/** @brief renders the bound source to a wav file as fast as it can
+ *
+ * Nothing is rendered until render() is called; it runs on the calling thread.
+ */
+class WavAudioOutput : public AudioOutput
+{
+public:
+    enum class SampleFormat
+    {
+        Int16,
+        Int24,
+        Float32,
+    };
+    struct Statistics
+    {
+        /** the length of the rendered audio in seconds */
+        double renderedDuration;
+        /** the wall clock time taken to render in seconds */
+        double elapsedTime;
+        /** @brief get how many times faster than playback the audio was rendered
+         */
+        double getRealtimeFactor() const
+        {
+            if(elapsedTime <= 0)
+                return INFINITY;
+            return renderedDuration / elapsedTime;
+        }
+    };
+    static constexpr unsigned defaultSampleRate = 44100;
+    static constexpr std::size_t defaultBlockFrameCount = 512;
+    /** the peak below which a block counts as silent when waiting for the tail to die away */
+    static constexpr float silenceThreshold = 1.0f / (1 << 24);
+private:
+    std::string fileName;
+    std::ofstream os;
+    SampleFormat sampleFormat;
+    unsigned sampleRate;
+    std::size_t blockFrameCount;
+    std::uint64_t writtenFrameCount;
+    std::shared_ptr<AudioSource> source;
+    std::mutex sourceLock;
+    std::vector<float> buffer;
+    std::vector<std::int16_t> samples16;
+    std::vector<char> bytes;
+    bool ditherEnabled;
+    TpdfDither dither;
+    std::size_t getBytesPerSample() const;
+    void writeHeader();
+    void writeBlock(std::size_t frameCount);
+public:
+    /** @brief construct a wav audio output
+     *
+     * @param fileName the wav file to write
+     * @param sampleFormat the format of the samples in the file
+     * @param sampleRate the sample rate in Hz
+     * @param blockFrameCount the number of frames to render at a time
+     * @throw std::runtime_error if the file can't be opened
+     *
+     */
+    explicit WavAudioOutput(std::string fileName, SampleFormat sampleFormat = SampleFormat::Int16, unsigned sampleRate = defaultSampleRate, std::size_t blockFrameCount = defaultBlockFrameCount);
+    bool getDither() const
+    {
+        return ditherEnabled;
+    }
+    /** @brief set whether to add triangular dither when writing 16 bit samples
+     */
+    void setDither(bool ditherEnabled)
+    {
+        this->ditherEnabled = ditherEnabled;
+    }
+    virtual void bind(std::shared_ptr<AudioSource> src) override;
+    virtual void lock() override
+    {
+        sourceLock.lock();
+    }
+    virtual void unlock() override
+    {
+        sourceLock.unlock();
+    }
+    virtual bool try_lock() override
+    {
+        return sourceLock.try_lock();
+    }
+    /** @brief render the bound source to the file
+     *
+     * Stops after maxDuration or, once finished returns true, at the first block that is silent
+     * so release tails aren't cut off. The file is complete when this returns.
+     *
+     * @param maxDuration the most audio to render in seconds
+     * @param finished checked after every block or nullptr to render until maxDuration
+     * @return the time rendered and how long it took
+     * @throw std::runtime_error if the file can't be written
+     *
+     */
+    Statistics render(double maxDuration, std::function<bool()> finished = nullptr);
+};
+
+#endif // WAV_AUDIO_OUTPUT_H_INCLUDED